@@ -0,0 +1,2024 @@
+#define _GNU_SOURCE                 /* tee(), splice() and pipe2() */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <signal.h>
+#include <errno.h>
+
+#include "sshell.h"
+
+/*
+ * libsshell: parses, checks, spawns and reaps the jobs of sshell. It prints nothing and keeps
+ *  no state outside of the jobs, so it can run any number of jobs from any number of callers
+ */
+
+/*************************************************************
+ *                    STRUCT and ENUM DEFINITIONS            *
+ *************************************************************/
+
+/* parsing option code */
+enum {
+    ARGUMENT,
+    INPUT,
+    OUTPUT,
+    APPEND
+};
+
+/* the command of a relay that forwards the signals to it, only ever set in the relay */
+static pid_t relayed_command;
+
+/*************************************************************
+ *                    LOCAL FUNCTION PROTOTYPES              *
+ *************************************************************/
+
+static void *default_alloc(void *data, size_t size);
+static void default_release(void *data, void *ptr);
+static void insert_command(struct sshell_command **root, struct sshell_command *cmd);
+static struct sshell_command *read_command(const struct sshell_job *job, char *command);
+static int skip_quote(const char *command, int i);
+static int is_substitution(const char *word);
+static int skip_substitution(const char *command, int i, int *closed);
+static int skip_group(const char *command, int i, int *closed);
+static int read_branches(const struct sshell_job *job, struct sshell_command *cmd, char *command);
+static void free_command(const struct sshell_job *job, struct sshell_command *cmd);
+static int is_valid_command(const struct sshell_command *cmd);
+static int check_redirection_file(const char *file, int mode);
+static int check_command(const struct sshell_command *cmd, int num_processes, int index, int check_files);
+static int check_substitutions(const struct sshell_command *cmd, int check_files);
+static int check_branches(const struct sshell_command *cmd, int num_processes, int index, int check_files);
+static void skip_commands(struct sshell_command *cmd, int error_code);
+static int spawn_command(struct sshell_job *job, struct sshell_command *cmd,
+    const struct sshell_hooks *hooks, int in_fd, int out_fd);
+static int spawn_branches(struct sshell_job *job, struct sshell_command *cmd,
+    const struct sshell_hooks *hooks, int in_fd, int out_fd);
+static void finish_branches(struct sshell_command *cmd);
+static char **substitution_word(struct sshell_command *cmd, int place);
+static int start_substitutions(struct sshell_job *job, struct sshell_command *cmd,
+    const struct sshell_hooks *hooks, int *fds);
+static void child_error(int error_fd, int error_code);
+static int open_input_files(const struct sshell_command *cmd, int *fds);
+static int open_output_files(const struct sshell_command *cmd, int *fds);
+static size_t splice_all(int in_fd, int out_fd, size_t length);
+static int splice_file(int in_fd, int out_fd);
+static void feed_input(int out_fd, const int *in_fds, int num_input);
+static void relay_output(int in_fd, const int *out_fds, int num_output);
+static void supervise(const struct sshell_command *cmd, int error_fd, int forward);
+static void forward_signal(int sig);
+static pid_t unfinished_pid(const struct sshell_job *job);
+static void signal_commands(const struct sshell_job *job, int sig);
+
+/*************************************************************
+ *                    MEMORY                                 *
+ *************************************************************/
+
+/*
+ * This function allocates with malloc(), for the jobs without an allocator
+ * @param - {void *} - unused
+ *        - {size_t} - the size
+ * @return - {void *} - the memory, NULL if out of memory
+ */
+static void *default_alloc(void *data, size_t size) {
+    return malloc(size);
+}
+
+/*
+ * This function frees with free(), for the jobs without an allocator
+ * @param - {void *} - unused
+ *        - {void *} - the memory
+ * @return - none
+ */
+static void default_release(void *data, void *ptr) {
+    free(ptr);
+}
+
+/*
+ * This function allocates memory with the allocator of the job
+ * @param - {const sshell_job *} - the job
+ *        - {size_t} - the size
+ * @return - {void *} - the memory, NULL if out of memory
+ */
+void *sshell_alloc(const struct sshell_job *job, size_t size) {
+    return job->allocator.alloc(job->allocator.data, size);
+}
+
+/*
+ * This function frees memory with the allocator of the job
+ * @param - {const sshell_job *} - the job
+ *        - {void *} - the memory, may be NULL
+ * @return - none
+ */
+void sshell_release(const struct sshell_job *job, void *ptr) {
+    if(ptr) {
+        job->allocator.release(job->allocator.data, ptr);
+    }
+}
+
+/*
+ * This function copies the string with the allocator of the job
+ * @param - {const sshell_job *} - the job
+ *        - {const char *} - the string
+ * @return - {char *} - the copy, NULL if out of memory
+ */
+char *sshell_strdup(const struct sshell_job *job, const char *string) {
+    char *copy = sshell_alloc(job, strlen(string) + 1);
+    if(copy) {
+        strcpy(copy, string);
+    }
+    return copy;
+}
+
+/*************************************************************
+ *                    PARSING                                *
+ *************************************************************/
+
+/*
+ * This function inserts the command at the end of the job list
+ * @param - {sshell_command **} - the head of the job list
+ *        - {sshell_command *} - the command to be inserted
+ * @return - none
+ */
+static void insert_command(struct sshell_command **root, struct sshell_command *cmd) {
+    /* the job is empty */
+    if(*root == NULL) {
+        *root = cmd;
+    } else {
+        struct sshell_command *node = *root;
+        /* this will find last node of of the job list */
+        while(node->next_command) {
+            node = node->next_command;
+        }
+        /* insert the command to the end */
+        node->next_command = cmd;
+    }
+    return;
+}
+
+/*
+ * This function parses the whole command line and store each command as a linked list
+ * @param - {const char *} - the command line
+ *        - {const sshell_allocator *} - the allocator of the job, NULL for malloc() and free()
+ * @return - {sshell_job *} - the stored job, NULL if out of memory
+ */
+struct sshell_job *sshell_parse(const char *line, const struct sshell_allocator *allocator) {
+    static const struct sshell_allocator default_allocator = {default_alloc, default_release, NULL};
+    char commands[SSHELL_MAX_CMD];
+    struct sshell_command *cmd;
+    struct sshell_job *job;
+    int i, j, length, next;
+
+    if(allocator == NULL) {
+        allocator = &default_allocator;
+    }
+    job = allocator->alloc(allocator->data, sizeof(struct sshell_job));  /* allocate space for job struct */
+    if(job == NULL) {
+        return NULL;
+    }
+    job->allocator = *allocator;                                /* the job frees itself with it */
+    job->num_processes = 1;                                     /* initialize number of processes */
+    job->next_job = NULL;                                       /* initialize next job to NULL */
+    job->finish = SSHELL_NOT_FINISHED;                          /* initializes not finish */
+    job->first_command = NULL;                                  /* initialize first job to NULL */
+    job->pgid = 0;                                              /* initialize no process group */
+    job->grouped = 1;                                           /* initialize a group of its own */
+    job->stopped = 0;                                           /* initialize not stopped */
+    job->data = NULL;                                           /* initialize no caller data */
+
+    strncpy(commands, line, SSHELL_MAX_CMD - 1);
+    commands[SSHELL_MAX_CMD - 1] = 0;
+    strcpy(job->commandline, commands);         /* store the whole command line */
+
+    /* find number of processes, the pipes of a process substitution or of branches are their own */
+    for(i = 0; commands[i]; i++) {
+        if(commands[i] == '\'' || commands[i] == '"') {
+            i = skip_quote(commands, i) - 1;
+        } else if(is_substitution(commands + i)) {
+            i = skip_substitution(commands, i, NULL) - 1;
+        } else if(commands[i] == '|') {
+            job->num_processes++;
+            commands[i] = 0;                    /* split the commands */
+            for(j = i + 1; commands[j] == ' ' || commands[j] == '\t'; j++);
+            if(commands[j] == '{') {            /* |{ a ; b } is one command */
+                i = skip_group(commands, j, NULL) - 1;
+            }
+        }
+    }
+    length = i;
+
+    /* one command or more, empty ones are left out */
+    for(i = 0; i < length; i = next) {
+        next = i + strlen(commands + i) + 1;    /* before read_command() cuts the command */
+        if(commands[i] == 0) {
+            continue;
+        }
+        cmd = read_command(job, commands + i);
+        if(cmd == NULL) {
+            sshell_free_job(job);
+            return NULL;
+        }
+        insert_command(&(job->first_command), cmd);
+    }
+    return job;
+}
+
+/*
+ * This function parses the command and store it as a command struct
+ * @param - {const sshell_job *} - the job allocating the command
+ *        - {char *} - the command to be parsed
+ * @return - {sshell_command *} - the command struct, NULL if out of memory
+ */
+static struct sshell_command *read_command(const struct sshell_job *job, char *command) {
+    char arg[SSHELL_MAX_CMD];
+    char *word;
+    struct sshell_substitution *sub;
+    int num_white_space, i, j, end;
+    int append = 0, out_of_memory = 0, substitution, closed = 0;
+    char quote;
+    int read_code = ARGUMENT;
+
+    struct sshell_command *cmd = sshell_alloc(job, sizeof(struct sshell_command));   /* allocate space for comamnd */
+    if(cmd == NULL) {
+        return NULL;
+    }
+    cmd->num_args = 0;                  /* initialize number of arguments */
+    cmd->num_input = 0;                 /* initialize number of input redirections */
+    cmd->num_output = 0;                /* initialize number of output redirections */
+    cmd->background = 0;                /* initialize number of background signs */
+    cmd->next_command = NULL;           /* next command initializes to null */
+    cmd->finish = SSHELL_NOT_FINISHED;  /* initialize not finish command */
+    cmd->pid = 0;                       /* initialize no process */
+    cmd->status = 0;                    /* initialize no status */
+    cmd->error = SSHELL_SUCCESS;        /* initialize no error */
+    cmd->num_substitutions = 0;         /* initialize no process substitution */
+    cmd->num_branches = 0;              /* initialize no branches */
+
+    /* get rid of leading spaces and tabs*/
+    for(num_white_space = 0; command[num_white_space] == ' ' ||
+        command[num_white_space] == '\t'; num_white_space++);
+
+    command = command + num_white_space;
+
+    /* get rid of trailing spaces and tabs */
+    for(i = strlen(command) - 1; i >= 0
+        && (command[i] == ' ' || command[i] == '\t'); i--) {
+        command[i] = 0;
+    }
+
+    strcpy(cmd->command, command);      /* store command line */
+
+    /* parse the command manually, the branches of |{ a ; b } are parsed as jobs */
+    i = 0;
+    if(command[0] == '{') {
+        out_of_memory = read_branches(job, cmd, command);
+        i = strlen(command);
+    }
+    while(i < strlen(command)) {
+        j = 0;
+
+        /* get the argument, a process substitution is one up to its closing parenthesis */
+        substitution = is_substitution(command + i);
+        if(substitution) {
+            end = skip_substitution(command, i, &closed);
+            while(i < end) {
+                arg[j++] = command[i++];
+            }
+        }
+        while(!substitution && command[i] != ' ' && command[i] != '<' && command[i] != '>'
+            && command[i] != 0 && command[i] != '&') {
+            if(command[i] == '\'' || command[i] == '"') {    /* quoted text is part of the word, unquoted */
+                quote = command[i++];
+                while(command[i] != quote && command[i] != 0) {
+                    arg[j++] = command[i++];
+                }
+                i += command[i] == quote;
+                continue;
+            }
+            arg[j++] = command[i++];
+        }
+        arg[j] = 0;             /* add null terminator */
+
+        for(; command[i] == ' ' || command[i] == '\t'; i++);        /* get rid of leading spaces and tabs*/
+
+        /* a missing file is stored as NULL for the checks */
+        word = NULL;
+        if(read_code == ARGUMENT || arg[0] != 0) {
+            word = sshell_strdup(job, arg);
+            out_of_memory |= word == NULL;
+        }
+        if(substitution && cmd->num_substitutions < SSHELL_MAX_SUBST) {   /* the pipeline replacing the word */
+            sub = &(cmd->substitutions[cmd->num_substitutions++]);
+            sub->output = arg[0] == '>';
+            sub->place = read_code == INPUT ? SSHELL_IN_INPUT : read_code == OUTPUT ? SSHELL_IN_OUTPUT : SSHELL_IN_ARGS;
+            sub->job = NULL;
+            if(closed) {
+                arg[j - 1] = 0;
+                sub->job = sshell_parse(arg + 2, &(job->allocator));
+                out_of_memory |= sub->job == NULL;
+            }
+        }
+        switch(read_code) {
+            case ARGUMENT:      /* an argument for the program */
+                if(cmd->num_args < SSHELL_MAX_ARGS - 1) {
+                    cmd->args[cmd->num_args++] = word;
+                } else {
+                    sshell_release(job, word);
+                }
+                break;
+            case INPUT:         /* input file */
+                cmd->input_file[cmd->num_input++] = word;
+                read_code = ARGUMENT;
+                break;
+            case OUTPUT:        /* output file */
+                cmd->output_append[cmd->num_output] = append;
+                cmd->output_file[cmd->num_output++] = word;
+                read_code = ARGUMENT;
+                break;
+        }
+
+        /* check for redirections */
+        if(is_substitution(command + i)) {                          /* the next argument */
+            continue;
+        } else if(command[i] == '<') {                              /* read input file for next argument */
+            read_code = INPUT;
+            i++;
+            for(; command[i] == ' ' || command[i] == '\t'; i++);    /* get rid of leading spaces tabs */
+        } else if(command[i] == '>') {                              /* read output file for next argument */
+            read_code = OUTPUT;
+            i++;
+            append = command[i] == '>';                             /* >> appends to the file */
+            if(append) {
+                i++;
+            }
+            for(; command[i] == ' ' || command[i] == '\t'; i++);    /* get rid of leading spaces and tabs */
+        } else if(command[i] == '&') {
+            cmd->background++;
+            i++;
+            for(; command[i] == ' ' || command[i] == '\t'; i++);    /* get rid of leading spaces and tabs */
+        }
+        if((cmd->num_input == SSHELL_MAX_ARGS && read_code == INPUT) ||
+            (cmd->num_output == SSHELL_MAX_ARGS && read_code == OUTPUT)) {
+            read_code = ARGUMENT;                                   /* no room for another file */
+        }
+    }
+
+    /* check given files */
+    if(read_code == INPUT) {
+        cmd->input_file[cmd->num_input++] = NULL;                   /* use null to indicate not given file */
+    } else if (read_code == OUTPUT) {
+        cmd->output_append[cmd->num_output] = append;
+        cmd->output_file[cmd->num_output++] = NULL;                 /* use null to indicate not given file */
+    }
+
+    cmd->args[cmd->num_args] = NULL;                                /* set null terminator */
+    if(out_of_memory) {
+        free_command(job, cmd);
+        sshell_release(job, cmd);
+        return NULL;
+    }
+    return cmd;
+}
+
+/*
+ * This function finds the end of the quoted text starting at the index: up to the same
+ *  quote, nothing is special inside
+ * @param - {const char *} - the command
+ *        - {int} - index of the opening quote
+ * @return - {int} - index after the closing quote, or of the end of the command
+ */
+static int skip_quote(const char *command, int i) {
+    char quote = command[i];
+
+    for(i++; command[i] && command[i] != quote; i++);
+    return command[i] ? i + 1 : i;
+}
+
+/*
+ * This function checks if the word starts a process substitution: <( or >(
+ * @param - {const char *} - the word, NULL for a missing file
+ * @return - {int} - one for a process substitution
+ */
+static int is_substitution(const char *word) {
+    return word && (word[0] == '<' || word[0] == '>') && word[1] == '(';
+}
+
+/*
+ * This function finds the end of the process substitution starting at the index
+ * @param - {const char *} - the command
+ *        - {int} - index of the < or > of the process substitution
+ *        - {int *} - set to one if the parenthesis is closed, may be NULL
+ * @return - {int} - index after the closing parenthesis, or of the end of the command
+ */
+static int skip_substitution(const char *command, int i, int *closed) {
+    int depth = 0;
+
+    for(i++; command[i]; i++) {
+        if(command[i] == '\'' || command[i] == '"') {
+            i = skip_quote(command, i) - 1;
+            continue;
+        }
+        depth += command[i] == '(';
+        depth -= command[i] == ')';
+        if(depth == 0) {
+            break;
+        }
+    }
+    if(closed) {
+        *closed = command[i] != 0;
+    }
+    return command[i] ? i + 1 : i;
+}
+
+/*
+ * This function finds the end of the braces of branches starting at the index
+ * @param - {const char *} - the command
+ *        - {int} - index of the opening brace
+ *        - {int *} - set to one if the brace is closed, may be NULL
+ * @return - {int} - index after the closing brace, or of the end of the command
+ */
+static int skip_group(const char *command, int i, int *closed) {
+    int depth = 0;
+
+    for(; command[i]; i++) {
+        if(command[i] == '\'' || command[i] == '"') {
+            i = skip_quote(command, i) - 1;
+            continue;
+        } else if(is_substitution(command + i)) {
+            i = skip_substitution(command, i, NULL) - 1;
+            continue;
+        }
+        depth += command[i] == '{';
+        depth -= command[i] == '}';
+        if(depth == 0) {
+            break;
+        }
+    }
+    if(closed) {
+        *closed = command[i] != 0;
+    }
+    return command[i] ? i + 1 : i;
+}
+
+/*
+ * This function parses the branches of |{ a | b ; c }: pipelines separated by ;, each reading
+ *  a copy of the output of the previous command, and the output redirections and background
+ *  signs after the braces. A syntax error leaves a NULL branch
+ * @param - {const sshell_job *} - the job allocating the branches
+ *        - {sshell_command *} - the command of the branches
+ *        - {char *} - the command, starting with its opening brace
+ * @return - {int} - one if out of memory, zero otherwise
+ */
+static int read_branches(const struct sshell_job *job, struct sshell_command *cmd, char *command) {
+    struct sshell_job *branch;
+    char file[SSHELL_MAX_CMD], quote;
+    int i, j, start, end, closed, last;
+
+    /* only output files and background signs may follow the braces */
+    end = skip_group(command, 0, &closed);
+    for(i = end; command[i] == ' ' || command[i] == '\t' || command[i] == '&' || command[i] == '>'; ) {
+        if(command[i] != '>') {
+            cmd->background += command[i++] == '&';
+            continue;
+        }
+        cmd->output_append[cmd->num_output] = command[i + 1] == '>';
+        i += 1 + cmd->output_append[cmd->num_output];
+        for(; command[i] == ' ' || command[i] == '\t'; i++);
+        for(j = 0; command[i] && command[i] != ' ' && command[i] != '\t' && command[i] != '&' &&
+            command[i] != '>' && command[i] != '<'; ) {
+            if(command[i] == '\'' || command[i] == '"') {  /* quoted text is part of the name */
+                quote = command[i++];
+                while(command[i] != quote && command[i] != 0) {
+                    file[j++] = command[i++];
+                }
+                i += command[i] == quote;
+                continue;
+            }
+            file[j++] = command[i++];
+        }
+        file[j] = 0;
+        cmd->output_file[cmd->num_output] = NULL;       /* a missing file is stored as NULL */
+        if(j > 0 && (cmd->output_file[cmd->num_output] = sshell_strdup(job, file)) == NULL) {
+            return 1;
+        }
+        if(++cmd->num_output == SSHELL_MAX_ARGS) {
+            break;
+        }
+    }
+    if(!closed || command[i] != 0) {
+        cmd->branches[cmd->num_branches++] = NULL;
+        return 0;
+    }
+
+    command[end - 1] = 0;                                   /* between the braces */
+    for(start = i = 1; ; i++) {
+        if(command[i] == '\'' || command[i] == '"') {
+            i = skip_quote(command, i) - 1;
+            continue;
+        } else if(is_substitution(command + i)) {
+            i = skip_substitution(command, i, NULL) - 1;
+            continue;
+        } else if(command[i] == '{') {
+            i = skip_group(command, i, NULL) - 1;
+            continue;
+        } else if(command[i] != ';' && command[i] != 0) {
+            continue;
+        }
+
+        last = command[i] == 0;
+        command[i] = 0;
+        for(j = start; command[j] == ' ' || command[j] == '\t'; j++);
+        if(command[j] == 0 && last && cmd->num_branches > 0) {  /* { a ; b ; } */
+            return 0;
+        }
+        if(command[j] == 0 || cmd->num_branches == SSHELL_MAX_BRANCHES) {
+            if(cmd->num_branches == SSHELL_MAX_BRANCHES) {  /* too many of them */
+                sshell_free_job(cmd->branches[--cmd->num_branches]);
+            }
+            cmd->branches[cmd->num_branches++] = NULL;
+            return 0;
+        }
+        branch = sshell_parse(command + start, &(job->allocator));
+        if(branch == NULL) {
+            return 1;
+        }
+        cmd->branches[cmd->num_branches++] = branch;
+        if(last) {
+            return 0;
+        }
+        start = i + 1;
+    }
+}
+
+/*
+ * This function copies a parsed job so a cached job can run again without parsing
+ * @param - {const sshell_job *} - the job to copy
+ * @return - {sshell_job *} - the copied job with the same allocator, NULL if out of memory
+ */
+struct sshell_job *sshell_clone(const struct sshell_job *job) {
+    int i, out_of_memory = 0;
+    const struct sshell_command *node;
+    struct sshell_job *copy = sshell_alloc(job, sizeof(struct sshell_job));
+
+    if(copy == NULL) {
+        return NULL;
+    }
+    *copy = *job;
+    copy->first_command = NULL;
+    copy->next_job = NULL;
+    copy->finish = SSHELL_NOT_FINISHED;
+    copy->pgid = 0;
+    copy->stopped = 0;
+    copy->data = NULL;
+
+    for(node = job->first_command; node && !out_of_memory; node = node->next_command) {
+        struct sshell_command *cmd = sshell_alloc(job, sizeof(struct sshell_command));
+        if(cmd == NULL) {
+            break;
+        }
+        *cmd = *node;
+        cmd->next_command = NULL;
+        cmd->finish = SSHELL_NOT_FINISHED;
+        cmd->error = SSHELL_SUCCESS;
+
+        /* duplicate the strings owned by the command */
+        for(i = 0; i < cmd->num_args; i++) {
+            cmd->args[i] = sshell_strdup(job, node->args[i]);
+            out_of_memory |= cmd->args[i] == NULL;
+        }
+        for(i = 0; i < cmd->num_input; i++) {
+            cmd->input_file[i] = node->input_file[i] ? sshell_strdup(job, node->input_file[i]) : NULL;
+            out_of_memory |= node->input_file[i] && cmd->input_file[i] == NULL;
+        }
+        for(i = 0; i < cmd->num_output; i++) {
+            cmd->output_file[i] = node->output_file[i] ? sshell_strdup(job, node->output_file[i]) : NULL;
+            out_of_memory |= node->output_file[i] && cmd->output_file[i] == NULL;
+        }
+        for(i = 0; i < cmd->num_substitutions; i++) {
+            cmd->substitutions[i].job = node->substitutions[i].job ? sshell_clone(node->substitutions[i].job) : NULL;
+            out_of_memory |= node->substitutions[i].job && cmd->substitutions[i].job == NULL;
+        }
+        for(i = 0; i < cmd->num_branches; i++) {
+            cmd->branches[i] = node->branches[i] ? sshell_clone(node->branches[i]) : NULL;
+            out_of_memory |= node->branches[i] && cmd->branches[i] == NULL;
+        }
+        insert_command(&(copy->first_command), cmd);
+    }
+
+    if(out_of_memory || node) {
+        sshell_free_job(copy);
+        return NULL;
+    }
+    return copy;
+}
+
+/*
+ * This function frees the memory allocated for the job struct
+ * @param - {sshell_job *} - the job struct, its data is left to the caller
+ * @return - none
+ */
+void sshell_free_job(struct sshell_job *job) {
+    struct sshell_allocator allocator = job->allocator;
+    struct sshell_command *node;
+    struct sshell_command *head = job->first_command;   /* initializes the head of the job list */
+
+    while(head != NULL) {
+        node = head;                            /* get the current node at the top of the job list */
+        head = head->next_command;              /* iterate to next node of the job list */
+        free_command(job, node);                /* free the command */
+        sshell_release(job, node);              /* free the node */
+    }
+    allocator.release(allocator.data, job);
+}
+
+/*
+ * This function frees the memory allocated for the arguments in the command line struct
+ * @param - {const sshell_job *} - the job of the command
+ *        - {sshell_command *} - the command line struct
+ * @return - none
+ */
+static void free_command(const struct sshell_job *job, struct sshell_command *cmd) {
+    int i;
+    /* free args space */
+    for(i = 0; i < (cmd->num_args); i++) {
+        sshell_release(job, cmd->args[i]);          /* free the allocated memory for each argument */
+    }
+
+    /* free input file space */
+    for(i = 0; i < (cmd->num_input); i++) {
+        sshell_release(job, cmd->input_file[i]);    /* free the allocated memory for each file */
+    }
+
+    /* free output file space */
+    for(i = 0; i < (cmd->num_output); i++) {
+        sshell_release(job, cmd->output_file[i]);   /* free the allocated memory for each file */
+    }
+
+    /* free the process substitutions */
+    for(i = 0; i < cmd->num_substitutions; i++) {
+        if(cmd->substitutions[i].job) {
+            sshell_free_job(cmd->substitutions[i].job);
+        }
+    }
+
+    /* free the branches */
+    for(i = 0; i < cmd->num_branches; i++) {
+        if(cmd->branches[i]) {
+            sshell_free_job(cmd->branches[i]);
+        }
+    }
+    return;
+}
+
+/*************************************************************
+ *                    CHECKING                               *
+ *************************************************************/
+
+/*
+ * This function check if the command line is valid
+ * @param - {const sshell_command *} - the command struct
+ * @return - {int} - error code
+ */
+static int is_valid_command(const struct sshell_command *cmd) {
+    if(cmd == NULL || cmd->command[0] == '<' || cmd->command[0] == 0 ||
+        cmd->command[0] == '>' || cmd->command[0] == '|' || cmd->command[0] == '&') {
+        return SSHELL_ERR_INVALID_CMDLINE;
+    }
+    return SSHELL_SUCCESS;
+}
+
+/*
+ * This function checks if the input/output file can be opened and if it is given
+ * @param - {const char *} - the name of the file
+ *        - {int} - check for input, output or append
+ * @return - error code
+ */
+static int check_redirection_file(const char *file, int mode) {
+    int fd;
+
+    /* file is not given */
+    if(file == NULL) {
+        return (mode == INPUT) ? SSHELL_ERR_NO_INPUTFILE : SSHELL_ERR_NO_OUTPUTFILE;
+    }
+
+    /* check input files */
+    if(mode == INPUT) {
+        /* check if the file can be opened */
+        fd = open(file, O_RDONLY);
+        if(fd < 0) {                                        /* error opening file for reading */
+            return SSHELL_ERR_OPEN_INPUTFILE;
+        }
+        close(fd);
+    } else {
+        /* file exists but file doesn't allow access */
+        fd = open(file, O_WRONLY | O_CREAT | (mode == APPEND ? O_APPEND : O_TRUNC), S_IRUSR | S_IWUSR);
+        if(fd < 0) {
+            return SSHELL_ERR_OPEN_OUTPUTFILE;              /* error opening file for writing */
+        }
+        close(fd);
+    }
+    return SSHELL_SUCCESS;
+}
+
+/*
+ * This function check if the command has redirection file errors or
+ *  mislocated input or output or background sign
+ * @param - {const sshell_command *} - the command struct
+ *        - {int} - number of total process
+ *        - {int} - the index of the command in the job list
+ *        - {int} - one to check the redirection files can be opened, zero for syntax only
+ * @return - {int} - error code
+ */
+static int check_command(const struct sshell_command *cmd, int num_processes, int index, int check_files) {
+    int i;
+    int input_index = 0, output_index = 0;
+    int error_code;
+
+    if(cmd->num_branches > 0) {                             /* no program, only pipelines */
+        return check_branches(cmd, num_processes, index, check_files);
+    }
+    for(i = 0; i < strlen(cmd->command); i++) {
+        if(cmd->command[i] == '\'' || cmd->command[i] == '"') {    /* quoted signs are text */
+            i = skip_quote(cmd->command, i) - 1;
+        } else if(is_substitution(cmd->command + i)) {      /* checked with its own pipeline */
+            i = skip_substitution(cmd->command, i, NULL) - 1;
+        } else if(cmd->command[i] == '<') {                 /* check for input file errors */
+            if(index != 0) {                                /* check for input mislocation */
+                return SSHELL_ERR_INPUT_MISLOCATED;
+            }
+            /* check input redirection */
+            if(input_index >= cmd->num_input || cmd->input_file[input_index] == NULL) {
+                return SSHELL_ERR_NO_INPUTFILE;
+            }
+            if(check_files && !is_substitution(cmd->input_file[input_index])) {
+                error_code = check_redirection_file(
+                    cmd->input_file[input_index], INPUT);
+                if(error_code != SSHELL_SUCCESS) {
+                    return error_code;
+                }
+            }
+            input_index++;
+        } else if(cmd->command[i] == '>') {                 /* check for output file errors */
+            /* check output redirection */
+            if(output_index >= cmd->num_output || cmd->output_file[output_index] == NULL) {
+                return SSHELL_ERR_NO_OUTPUTFILE;
+            }
+            if(cmd->command[i + 1] == '>') {                /* >> is one redirection */
+                i++;
+            }
+            if(check_files && !is_substitution(cmd->output_file[output_index])) {
+                error_code = check_redirection_file(cmd->output_file[output_index],
+                    cmd->output_append[output_index] ? APPEND : OUTPUT);
+                if(error_code != SSHELL_SUCCESS) {
+                    return error_code;
+                }
+            }
+            output_index++;
+        } else if(cmd->command[i] == '&') {                 /* check for background error */
+            if(index != num_processes - 1 ||
+                i != strlen(cmd->command) - 1) {
+                /* the background can only be the end of the last command */
+                return SSHELL_ERR_BACKGROUND_MISLOCATED;
+            }
+        }
+    }
+    if(output_index > 0 && index != num_processes - 1) {    /* check for output mislocation */
+        return SSHELL_ERR_OUTPUT_MISLOCATED;
+    }
+    return check_substitutions(cmd, check_files);
+}
+
+/*
+ * This function checks the branches of the command: they read the output of a command before
+ *  them, each is a valid pipeline not in the background, and at most one output file follows
+ *  the last group
+ * @param - {const sshell_command *} - the command struct
+ *        - {int} - number of total process
+ *        - {int} - the index of the command in the job list
+ *        - {int} - one to check the redirection files can be opened, zero for syntax only
+ * @return - {int} - error code
+ */
+static int check_branches(const struct sshell_command *cmd, int num_processes, int index, int check_files) {
+    int i, error_code;
+
+    if(index == 0) {                                        /* nothing to read */
+        return SSHELL_ERR_INVALID_CMDLINE;
+    }
+    if(cmd->background > 1 || (cmd->background && index != num_processes - 1)) {
+        return SSHELL_ERR_BACKGROUND_MISLOCATED;
+    }
+    if(cmd->num_output > 0) {                               /* one file for the output of all branches */
+        if(index != num_processes - 1) {
+            return SSHELL_ERR_OUTPUT_MISLOCATED;
+        }
+        if(cmd->output_file[0] == NULL) {
+            return SSHELL_ERR_NO_OUTPUTFILE;
+        }
+        if(cmd->num_output > 1) {
+            return SSHELL_ERR_INVALID_CMDLINE;
+        }
+        if(check_files) {
+            error_code = check_redirection_file(cmd->output_file[0], cmd->output_append[0] ? APPEND : OUTPUT);
+            if(error_code != SSHELL_SUCCESS) {
+                return error_code;
+            }
+        }
+    }
+    for(i = 0; i < cmd->num_branches; i++) {
+        if(cmd->branches[i] == NULL) {                      /* the braces do not close, or an empty branch */
+            return SSHELL_ERR_INVALID_CMDLINE;
+        }
+        error_code = sshell_validate(cmd->branches[i], check_files);
+        if(error_code != SSHELL_SUCCESS) {
+            return error_code;
+        }
+        if(sshell_last_command(cmd->branches[i])->background) {
+            return SSHELL_ERR_BACKGROUND_MISLOCATED;
+        }
+    }
+    return SSHELL_SUCCESS;
+}
+
+/*
+ * This function checks the process substitutions of the command: every <( or >( word is
+ *  one, closed, and its pipeline is valid and not in the background
+ * @param - {const sshell_command *} - the command struct
+ *        - {int} - one to check the redirection files can be opened, zero for syntax only
+ * @return - {int} - error code
+ */
+static int check_substitutions(const struct sshell_command *cmd, int check_files) {
+    struct sshell_job *job;
+    int i, num_words = 0, error_code;
+
+    for(i = 0; i < cmd->num_args; i++) {
+        num_words += is_substitution(cmd->args[i]);
+    }
+    for(i = 0; i < cmd->num_input; i++) {
+        num_words += is_substitution(cmd->input_file[i]);
+    }
+    for(i = 0; i < cmd->num_output; i++) {
+        num_words += is_substitution(cmd->output_file[i]);
+    }
+    if(num_words != cmd->num_substitutions) {               /* too many of them */
+        return SSHELL_ERR_INVALID_CMDLINE;
+    }
+
+    for(i = 0; i < cmd->num_substitutions; i++) {
+        job = cmd->substitutions[i].job;
+        if(job == NULL) {                                   /* the parenthesis is not closed */
+            return SSHELL_ERR_INVALID_CMDLINE;
+        }
+        error_code = sshell_validate(job, check_files);
+        if(error_code != SSHELL_SUCCESS) {
+            return error_code;
+        }
+        if(sshell_last_command(job)->background) {
+            return SSHELL_ERR_BACKGROUND_MISLOCATED;
+        }
+    }
+    return SSHELL_SUCCESS;
+}
+
+/*
+ * This function check if the job has any error before executing
+ * @param - {sshell_job *} - the job struct
+ *        - {int} - one to check the redirection files can be opened, zero for syntax only
+ * @return - {int} - error code
+ */
+int sshell_validate(struct sshell_job *job, int check_files) {
+    struct sshell_command *cmd = job->first_command;
+    int i, error_code;
+
+    for(i = 0; i < job->num_processes; i++) {
+        /* check valid command error */
+        error_code = is_valid_command(cmd);
+        if(error_code != SSHELL_SUCCESS)
+            return error_code;
+
+        /* check mislocated and redirection errors */
+        error_code = check_command(cmd, job->num_processes, i, check_files);
+        if(error_code != SSHELL_SUCCESS)
+            return error_code;
+
+        /* get next command */
+        cmd = cmd->next_command;
+    }
+    return SSHELL_SUCCESS;
+}
+
+/*
+ * This function gives the message of the error code
+ * @param - {int} - error code enum
+ * @return - {const char *} - the message
+ */
+const char *sshell_strerror(int error_code) {
+    switch(error_code) {
+        case(SSHELL_SUCCESS):
+            return "success";
+        case(SSHELL_FAILURE):
+            return "failure";
+        case(SSHELL_ERR_INVALID_CMDLINE):
+            return "invalid command line";
+        case(SSHELL_ERR_CMD_NOTFOUND):
+            return "command not found";
+        case(SSHELL_ERR_OPEN_INPUTFILE):
+            return "cannot open input file";
+        case(SSHELL_ERR_OPEN_OUTPUTFILE):
+            return "cannot open output file";
+        case(SSHELL_ERR_NO_INPUTFILE):
+            return "no input file";
+        case(SSHELL_ERR_NO_OUTPUTFILE):
+            return "no output file";
+        case(SSHELL_ERR_INPUT_MISLOCATED):
+            return "mislocated input redirection";
+        case(SSHELL_ERR_OUTPUT_MISLOCATED):
+            return "mislocated output redirection";
+        case(SSHELL_ERR_BACKGROUND_MISLOCATED):
+            return "mislocated background sign";
+        case(SSHELL_ERR_FORK):
+            return "cannot start process";
+    }
+    return "unknown error";
+}
+
+/*************************************************************
+ *                    SPAWNING                               *
+ *************************************************************/
+
+/*
+ * This function starts the commands of the job in one process group, connected by pipes
+ * @param - {sshell_job *} - the checked job
+ *        - {const sshell_hooks *} - the hooks of the caller, NULL for none
+ * @return - {int} - error code of the first command that failed to start, each command has its own
+ */
+int sshell_spawn(struct sshell_job *job, const struct sshell_hooks *hooks) {
+    struct sshell_hooks no_hooks;
+
+    if(hooks == NULL) {
+        memset(&no_hooks, 0, sizeof(no_hooks));
+        hooks = &no_hooks;
+    }
+    return spawn_command(job, job->first_command, hooks, -1, -1);
+}
+
+/*
+ * This function marks the commands that will not run as finished
+ * @param - {sshell_command *} - the first command not to run
+ *        - {int} - error code of the commands
+ * @return - none
+ */
+static void skip_commands(struct sshell_command *cmd, int error_code) {
+    int i;
+
+    for(; cmd; cmd = cmd->next_command) {
+        cmd->pid = 0;
+        cmd->status = W_EXITCODE(error_code == SSHELL_SUCCESS ? EXIT_SUCCESS : EXIT_FAILURE, 0);
+        cmd->finish = SSHELL_FINISHED;
+        cmd->error = error_code;
+        for(i = 0; i < cmd->num_substitutions; i++) {
+            skip_commands(cmd->substitutions[i].job->first_command, error_code);
+        }
+        for(i = 0; i < cmd->num_branches; i++) {
+            skip_commands(cmd->branches[i]->first_command, error_code);
+        }
+    }
+}
+
+/*
+ * This function pipelines the commands: connects the old's reading stream and creates new pipe for next process
+ * @param - {sshell_job *} - the job of the commands
+ *        - {sshell_command *} - the pipeline commands
+ *        - {const sshell_hooks *} - the hooks of the caller
+ *        - {int} - read end of the old pipe, -1 for the first command
+ *        - {int} - write end of the pipe for the output of the last command, -1 for none
+ * @return - {int} - error code of the first command that failed to start
+ */
+static int spawn_command(struct sshell_job *job, struct sshell_command *cmd,
+    const struct sshell_hooks *hooks, int in_fd, int out_fd) {
+    int new_fd[2], error_fd[2], sub_fds[SSHELL_MAX_SUBST];
+    int code = SSHELL_SPAWN, error_code = SSHELL_SUCCESS, sub_code = SSHELL_SUCCESS, next_code, status, i;
+    ssize_t n;
+    pid_t pid;
+
+    if(cmd->num_branches > 0) {                         /* a relay instead of a program */
+        return spawn_branches(job, cmd, hooks, in_fd, out_fd);
+    }
+
+    /* creates new pipe, only the commands dup it */
+    if(cmd->next_command && pipe2(new_fd, O_CLOEXEC) < 0) {
+        if(in_fd >= 0) {
+            close(in_fd);
+        }
+        if(out_fd >= 0) {
+            close(out_fd);
+        }
+        skip_commands(cmd, SSHELL_ERR_FORK);
+        return SSHELL_ERR_FORK;
+    }
+
+    /* the caller may run the command itself */
+    if(hooks->in_caller) {
+        code = hooks->in_caller(hooks->data, job, cmd);
+    }
+    if(code == SSHELL_RAN || code == SSHELL_STOP) {
+        for(i = 0; i < cmd->num_substitutions; i++) {  /* nothing reads or writes them */
+            skip_commands(cmd->substitutions[i].job->first_command, SSHELL_SUCCESS);
+        }
+        if(in_fd >= 0) {
+            close(in_fd);                               /* closing unnecessary files */
+        }
+        if(cmd->next_command) {
+            close(new_fd[1]);                           /* the next command reads end of file */
+            if(code == SSHELL_STOP) {
+                close(new_fd[0]);
+                skip_commands(cmd->next_command, SSHELL_SUCCESS);
+            } else {
+                return spawn_command(job, cmd->next_command, hooks, new_fd[0], out_fd);
+            }
+        }
+        if(out_fd >= 0) {
+            close(out_fd);
+        }
+        return SSHELL_SUCCESS;
+    }
+
+    /* the process substitutions run before the command, without the pipes of the job */
+    if(cmd->num_substitutions > 0) {
+        if(in_fd >= 0) {
+            fcntl(in_fd, F_SETFD, FD_CLOEXEC);
+        }
+        sub_code = start_substitutions(job, cmd, hooks, sub_fds);
+    }
+
+    /* the child reports its errors before exec through this pipe, exec closes it */
+    if(pipe2(error_fd, O_CLOEXEC) < 0) {
+        error_fd[0] = error_fd[1] = -1;
+    }
+    pid = fork();
+    if(pid == 0) {
+        /* child */
+        close(error_fd[0]);
+        if(job->grouped) {
+            setpgid(0, job->pgid);                      /* the first process leads the group */
+        }
+        if(hooks->in_child) {
+            hooks->in_child(hooks->data, job, cmd);
+        }
+        if(in_fd >= 0) {
+            dup2(in_fd, STDIN_FILENO);                  /* replace new read stream with old read stream */
+            close(in_fd);                               /* close unnecessary files */
+        }
+        if(cmd->next_command) {
+            close(new_fd[0]);                           /* closing unnecessary files */
+            dup2(new_fd[1], STDOUT_FILENO);
+            close(new_fd[1]);                           /* closing unnecessary files */
+        } else if(out_fd >= 0) {                        /* the last command of a process substitution */
+            dup2(out_fd, STDOUT_FILENO);
+            close(out_fd);
+        }
+        for(i = 0; i < cmd->num_substitutions; i++) {   /* /dev/fd/N stays open through exec */
+            if(sub_fds[i] >= 0) {
+                fcntl(sub_fds[i], F_SETFD, 0);
+            }
+        }
+
+        /* perform redirections */
+        if(cmd->num_input > 1 || cmd->num_output > 1) { /* concatenate the inputs, fan the output out */
+            supervise(cmd, error_fd[1], !job->grouped);
+        }
+        error_code = sshell_redirect(cmd);
+        if(error_code != SSHELL_SUCCESS) {
+            child_error(error_fd[1], error_code);
+        }
+
+        if(code == SSHELL_FORK) {                       /* the caller runs it: no exec */
+            close(error_fd[1]);
+            status = hooks->run_in_child ? hooks->run_in_child(hooks->data, job, cmd) : EXIT_FAILURE;
+            fflush(NULL);                               /* exit() would also move the offset of the */
+            _exit(status);                              /*  input shared with the caller to its stdin buffer */
+        }
+        execvp(cmd->args[0], cmd->args);
+        /* execvp error */
+        child_error(error_fd[1], SSHELL_ERR_CMD_NOTFOUND);
+    }
+
+    /* the ends of the process substitutions belong to the child now */
+    for(i = 0; i < cmd->num_substitutions; i++) {
+        if(sub_fds[i] >= 0) {
+            close(sub_fds[i]);
+        }
+    }
+    if(pid < 0) {                                       /* fork error */
+        close(error_fd[0]);
+        close(error_fd[1]);
+        if(in_fd >= 0) {
+            close(in_fd);
+        }
+        if(out_fd >= 0) {
+            close(out_fd);
+        }
+        if(cmd->next_command) {
+            close(new_fd[0]);
+            close(new_fd[1]);
+        }
+        cmd->pid = 0;                                   /* its process substitutions are reaped as started */
+        cmd->status = W_EXITCODE(EXIT_FAILURE, 0);
+        cmd->finish = SSHELL_FINISHED;
+        cmd->error = SSHELL_ERR_FORK;
+        skip_commands(cmd->next_command, SSHELL_ERR_FORK);
+        return SSHELL_ERR_FORK;
+    }
+
+    /* parent */
+    cmd->pid = pid;
+    if(job->pgid == 0) {                                /* the first process leads the group */
+        job->pgid = pid;
+    }
+    if(job->grouped) {
+        setpgid(pid, job->pgid);                        /* join the process group of the job */
+    }
+
+    /* the pipe is closed by exec, or it brings the error of the child */
+    close(error_fd[1]);
+    while((n = read(error_fd[0], &(cmd->error), sizeof(cmd->error))) < 0 && errno == EINTR);
+    if(n != sizeof(cmd->error)) {
+        cmd->error = SSHELL_SUCCESS;
+    }
+    close(error_fd[0]);
+    error_code = cmd->error == SSHELL_SUCCESS ? sub_code : cmd->error;
+
+    if(in_fd >= 0) {
+        close(in_fd);                                   /* closing unnecessary files */
+    }
+    if(cmd->next_command) {
+        close(new_fd[1]);                               /* closing unnecessary files */
+        if(hooks->on_pipe) {                            /* the caller may relay the pipe */
+            new_fd[0] = hooks->on_pipe(hooks->data, job, cmd, new_fd[0]);
+        }
+        next_code = spawn_command(job, cmd->next_command, hooks, new_fd[0], out_fd);
+        if(error_code == SSHELL_SUCCESS) {
+            error_code = next_code;
+        }
+    } else if(out_fd >= 0) {
+        close(out_fd);
+    }
+    return error_code;
+}
+
+/*
+ * This function starts the branches of |{ a ; b }: the process of the command is a relay copying
+ *  its input with tee() to a pipe for each branch, and the branches all write to the output of
+ *  the command, or to its output file. A full pipe blocks the relay, so the slowest branch paces
+ *  the commands before
+ * @param - {sshell_job *} - the job of the command
+ *        - {sshell_command *} - the command of the branches
+ *        - {const sshell_hooks *} - the hooks of the caller
+ *        - {int} - read end of the old pipe
+ *        - {int} - write end of the pipe for the output of the last command, -1 for none
+ * @return - {int} - error code of the first command that failed to start
+ */
+static int spawn_branches(struct sshell_job *job, struct sshell_command *cmd,
+    const struct sshell_hooks *hooks, int in_fd, int out_fd) {
+    int new_fd[2], branch_fds[SSHELL_MAX_BRANCHES][2], write_fds[SSHELL_MAX_BRANCHES];
+    int i, n, branch_out, file_fd, code, error_code = SSHELL_SUCCESS;
+    pid_t pid = -1;
+
+    /* |{ a ; b } > file: the branches share the file as their output */
+    if(cmd->num_output > 0) {
+        if(open_output_files(cmd, &file_fd) != SSHELL_SUCCESS) {
+            if(in_fd >= 0) {
+                close(in_fd);
+            }
+            if(out_fd >= 0) {
+                close(out_fd);
+            }
+            skip_commands(cmd, SSHELL_ERR_OPEN_OUTPUTFILE);
+            return SSHELL_ERR_OPEN_OUTPUTFILE;
+        }
+        fcntl(file_fd, F_SETFD, FD_CLOEXEC);
+        if(out_fd >= 0) {
+            close(out_fd);
+        }
+        out_fd = file_fd;
+    }
+
+    /* a pipe to each branch, and one from the branches to the next command */
+    for(n = 0; n < cmd->num_branches && pipe2(branch_fds[n], O_CLOEXEC) == 0; n++);
+    if(n == cmd->num_branches && (cmd->next_command == NULL || pipe2(new_fd, O_CLOEXEC) == 0)) {
+        pid = fork();
+        if(pid < 0 && cmd->next_command) {
+            close(new_fd[0]);
+            close(new_fd[1]);
+        }
+    }
+    if(pid == 0) {
+        /* the relay */
+        if(job->grouped) {
+            setpgid(0, job->pgid);
+        }
+        if(hooks->in_child) {
+            hooks->in_child(hooks->data, job, cmd);
+        }
+        signal(SIGPIPE, SIG_IGN);                       /* a branch may stop reading early */
+        for(i = 0; i < n; i++) {
+            close(branch_fds[i][0]);
+            write_fds[i] = branch_fds[i][1];
+        }
+        if(cmd->next_command) {
+            close(new_fd[0]);
+            close(new_fd[1]);
+        }
+        if(out_fd >= 0) {
+            close(out_fd);
+        }
+        relay_output(in_fd, write_fds, n);
+        _exit(EXIT_SUCCESS);
+    }
+
+    for(i = 0; i < n; i++) {                            /* the relay has the write ends */
+        close(branch_fds[i][1]);
+    }
+    if(in_fd >= 0) {
+        close(in_fd);
+    }
+    if(pid < 0) {                                       /* pipe or fork error */
+        for(i = 0; i < n; i++) {
+            close(branch_fds[i][0]);
+        }
+        if(out_fd >= 0) {
+            close(out_fd);
+        }
+        skip_commands(cmd, SSHELL_ERR_FORK);
+        return SSHELL_ERR_FORK;
+    }
+    cmd->pid = pid;
+    if(job->pgid == 0) {
+        job->pgid = pid;
+    }
+    if(job->grouped) {
+        setpgid(pid, job->pgid);
+    }
+
+    /* the branches, each writing to its own copy of the output */
+    branch_out = cmd->next_command ? new_fd[1] : out_fd;
+    for(i = 0; i < n; i++) {
+        code = spawn_command(job, cmd->branches[i]->first_command, hooks, branch_fds[i][0],
+            branch_out >= 0 ? fcntl(branch_out, F_DUPFD_CLOEXEC, 0) : -1);
+        if(error_code == SSHELL_SUCCESS) {
+            error_code = code;
+        }
+    }
+    if(branch_out >= 0) {
+        close(branch_out);
+    }
+
+    if(cmd->next_command) {
+        if(hooks->on_pipe) {                            /* the caller may relay the pipe */
+            new_fd[0] = hooks->on_pipe(hooks->data, job, cmd, new_fd[0]);
+        }
+        code = spawn_command(job, cmd->next_command, hooks, new_fd[0], out_fd);
+        if(error_code == SSHELL_SUCCESS) {
+            error_code = code;
+        }
+    }
+    return error_code;
+}
+
+/*
+ * This function gives the command of the branches the status of the last branch once the
+ *  relay and every branch finished
+ * @param - {sshell_command *} - the command
+ * @return - none
+ */
+static void finish_branches(struct sshell_command *cmd) {
+    int i;
+
+    if(cmd->num_branches == 0 || cmd->finish == SSHELL_NOT_FINISHED) {
+        return;
+    }
+    for(i = 0; i < cmd->num_branches; i++) {
+        if(sshell_check_finish(cmd->branches[i]) == SSHELL_NOT_FINISHED) {
+            return;
+        }
+    }
+    cmd->status = sshell_last_command(cmd->branches[cmd->num_branches - 1])->status;
+}
+
+/*
+ * This function finds the word of the next process substitution of the command in the place,
+ *  the caller may have moved the arguments since the parsing
+ * @param - {sshell_command *} - the command
+ *        - {int} - place code of the word
+ * @return - {char **} - the argument or the redirection file, NULL if none is left
+ */
+static char **substitution_word(struct sshell_command *cmd, int place) {
+    char **words = cmd->args;
+    int i, num_words = cmd->num_args;
+
+    if(place == SSHELL_IN_INPUT) {
+        words = cmd->input_file;
+        num_words = cmd->num_input;
+    } else if(place == SSHELL_IN_OUTPUT) {
+        words = cmd->output_file;
+        num_words = cmd->num_output;
+    }
+    for(i = 0; i < num_words; i++) {
+        if(is_substitution(words[i])) {
+            return &(words[i]);
+        }
+    }
+    return NULL;
+}
+
+/*
+ * This function starts the process substitutions of the command in the process group of the job:
+ *  each pipeline gets one end of a pipe, and /dev/fd/N of the other end replaces its word,
+ *  /dev/null if it did not start
+ * @param - {sshell_job *} - the job of the command
+ *        - {sshell_command *} - the command
+ *        - {const sshell_hooks *} - the hooks of the caller
+ *        - {int *} - the ends of the pipes for the command, -1 for a pipeline that did not start
+ * @return - {int} - error code of the first process substitution that failed to start
+ */
+static int start_substitutions(struct sshell_job *job, struct sshell_command *cmd,
+    const struct sshell_hooks *hooks, int *fds) {
+    struct sshell_substitution *sub;
+    char path[32], **word, *name;
+    int i, fd[2], code, error_code = SSHELL_SUCCESS;
+
+    for(i = 0; i < cmd->num_substitutions; i++) {
+        sub = &(cmd->substitutions[i]);
+        fds[i] = -1;
+        if(pipe2(fd, O_CLOEXEC) < 0) {
+            skip_commands(sub->job->first_command, SSHELL_ERR_FORK);
+            code = SSHELL_ERR_FORK;
+        } else if(sub->output) {                        /* the pipeline reads what the command writes */
+            code = spawn_command(job, sub->job->first_command, hooks, fd[0], -1);
+            fds[i] = fd[1];
+        } else {                                        /* the command reads what the pipeline writes */
+            code = spawn_command(job, sub->job->first_command, hooks, -1, fd[1]);
+            fds[i] = fd[0];
+        }
+        if(error_code == SSHELL_SUCCESS) {
+            error_code = code;
+        }
+
+        if(fds[i] >= 0) {
+            snprintf(path, sizeof(path), "/dev/fd/%d", fds[i]);
+        } else {
+            strcpy(path, "/dev/null");
+        }
+        word = substitution_word(cmd, sub->place);
+        name = sshell_strdup(job, path);
+        if(word && name) {
+            sshell_release(job, *word);
+            *word = name;
+        } else if(name) {
+            sshell_release(job, name);
+        }
+    }
+    return error_code;
+}
+
+/*
+ * This function reports the error of the child before exec to the caller and leaves
+ * @param - {int} - write end of the error pipe
+ *        - {int} - error code
+ * @return - none, the child leaves
+ */
+static void child_error(int error_fd, int error_code) {
+    ssize_t n = write(error_fd, &error_code, sizeof(error_code));
+    (void) n;                                           /* nobody to tell if it fails */
+    _exit(EXIT_FAILURE);
+}
+
+/*************************************************************
+ *                    REAPING                                *
+ *************************************************************/
+
+/*
+ * This function stores the status of the process if it belongs to the job
+ * @param - {sshell_job *} - the job
+ *        - {pid_t} - the id to find
+ *        - {int} - the exit status of that pid
+ * @return - {int} - one if the process is a command of the job, zero otherwise
+ */
+int sshell_record(struct sshell_job *job, pid_t pid, int status) {
+    struct sshell_command *cmd_node = job->first_command;
+    int i;
+
+    /* this will find node tha has the pid */
+    while(cmd_node && (cmd_node->pid != pid || pid <= 0)) {
+        cmd_node = cmd_node->next_command;
+    }
+    if(cmd_node == NULL) {                              /* it may be a process of a process substitution */
+        for(cmd_node = job->first_command; cmd_node; cmd_node = cmd_node->next_command) {
+            for(i = 0; i < cmd_node->num_substitutions; i++) {
+                if(sshell_record(cmd_node->substitutions[i].job, pid, status)) {
+                    job->finish = sshell_check_finish(job);
+                    return 1;
+                }
+            }
+            for(i = 0; i < cmd_node->num_branches; i++) {   /* or of a branch */
+                if(sshell_record(cmd_node->branches[i], pid, status)) {
+                    finish_branches(cmd_node);
+                    job->finish = sshell_check_finish(job);
+                    return 1;
+                }
+            }
+        }
+        return 0;
+    }
+    /* found it and insert the status to the node */
+    cmd_node->status = status;
+    cmd_node->finish = SSHELL_FINISHED;
+    finish_branches(cmd_node);
+    job->finish = sshell_check_finish(job);
+    return 1;
+}
+
+/*
+ * This function reaps the finished processes of the job without blocking
+ * @param - {sshell_job *} - the job
+ * @return - {int} - finish flag of the job
+ */
+int sshell_poll(struct sshell_job *job) {
+    struct sshell_command *cmd;
+    int status, i;
+    pid_t pid;
+
+    for(cmd = job->first_command; cmd; cmd = cmd->next_command) {
+        for(i = 0; i < cmd->num_substitutions; i++) {
+            sshell_poll(cmd->substitutions[i].job);
+            job->stopped |= cmd->substitutions[i].job->stopped;
+        }
+        for(i = 0; i < cmd->num_branches; i++) {
+            sshell_poll(cmd->branches[i]);
+            job->stopped |= cmd->branches[i]->stopped;
+        }
+        if(!cmd->finish && cmd->pid > 0) {
+            pid = waitpid(cmd->pid, &status, WNOHANG | WUNTRACED);  /* check if that subprocess has completed */
+            if(pid > 0 && WIFSTOPPED(status)) {                     /* a process was stopped */
+                job->stopped = 1;
+            } else if(pid > 0) {                                    /* a process has finished */
+                sshell_record(job, pid, status);
+            }
+        }
+        finish_branches(cmd);
+    }
+    job->finish = sshell_check_finish(job);
+    return job->finish;
+}
+
+/*
+ * This function waits until the job finishes
+ * @param - {sshell_job *} - the job
+ * @return - {int} - exit status of the last command of the job, -1 if it cannot finish
+ */
+int sshell_wait(struct sshell_job *job) {
+    pid_t pid;
+    int status;
+
+    while(job->pgid && sshell_check_finish(job) != SSHELL_FINISHED) {
+        pid = sshell_waitpid(job, &status, 0);
+        if(pid < 0 && errno == EINTR) {
+            continue;
+        }
+        if(pid < 0) {                                   /* no process left in the group */
+            break;
+        }
+        sshell_record(job, pid, status);
+    }
+    job->finish = sshell_check_finish(job);
+    return sshell_status(job);
+}
+
+/*
+ * This function waits for a process of the job like waitpid(): any process of its group, or
+ *  one of its processes not reaped yet when it has no group of its own
+ * @param - {const sshell_job *} - the job
+ *        - {int *} - the wait status of the process
+ *        - {int} - the options of waitpid()
+ * @return - {pid_t} - the process, zero with WNOHANG if none changed, -1 if none is left
+ */
+pid_t sshell_waitpid(const struct sshell_job *job, int *status, int options) {
+    pid_t pid;
+
+    if(job->grouped) {
+        return waitpid(-job->pgid, status, options);
+    }
+    pid = unfinished_pid(job);
+    if(pid == 0) {
+        errno = ECHILD;
+        return -1;
+    }
+    return waitpid(pid, status, options);
+}
+
+/*
+ * This function finds a process of the job, of its process substitutions or of its branches
+ *  that was not reaped yet
+ * @param - {const sshell_job *} - the job
+ * @return - {pid_t} - the process, zero if none is left
+ */
+static pid_t unfinished_pid(const struct sshell_job *job) {
+    const struct sshell_command *cmd;
+    pid_t pid;
+    int i;
+
+    for(cmd = job->first_command; cmd; cmd = cmd->next_command) {
+        if(!cmd->finish && cmd->pid > 0) {
+            return cmd->pid;
+        }
+        for(i = 0; i < cmd->num_substitutions; i++) {
+            if((pid = unfinished_pid(cmd->substitutions[i].job))) {
+                return pid;
+            }
+        }
+        for(i = 0; i < cmd->num_branches; i++) {
+            if((pid = unfinished_pid(cmd->branches[i]))) {
+                return pid;
+            }
+        }
+    }
+    return 0;
+}
+
+/*
+ * This function sends the signal to the processes of the job: to its process group, or to each
+ *  process not reaped yet when it has no group of its own
+ * @param - {const sshell_job *} - the job
+ *        - {int} - the signal
+ * @return - {int} - zero on success, -1 if the job has no process
+ */
+int sshell_signal(const struct sshell_job *job, int sig) {
+    if(job->pgid == 0) {
+        errno = ESRCH;
+        return -1;
+    }
+    if(job->grouped) {
+        return killpg(job->pgid, sig);
+    }
+    signal_commands(job, sig);
+    return 0;
+}
+
+/*
+ * This function sends the signal to each process of the job not reaped yet
+ * @param - {const sshell_job *} - the job
+ *        - {int} - the signal
+ * @return - none
+ */
+static void signal_commands(const struct sshell_job *job, int sig) {
+    const struct sshell_command *cmd;
+    int i;
+
+    for(cmd = job->first_command; cmd; cmd = cmd->next_command) {
+        if(!cmd->finish && cmd->pid > 0) {
+            kill(cmd->pid, sig);
+        }
+        for(i = 0; i < cmd->num_substitutions; i++) {
+            signal_commands(cmd->substitutions[i].job, sig);
+        }
+        for(i = 0; i < cmd->num_branches; i++) {
+            signal_commands(cmd->branches[i], sig);
+        }
+    }
+}
+
+/*
+ * This function gets the exit status of the job
+ * @param - {const sshell_job *} - the job
+ * @return - {int} - exit status of the last command, -1 if the job is not finished
+ */
+int sshell_status(const struct sshell_job *job) {
+    if(sshell_check_finish(job) != SSHELL_FINISHED) {
+        return -1;
+    }
+    return sshell_exit_status(sshell_last_command(job)->status);
+}
+
+/*
+ * This function gives the exit status a shell shows for a wait status
+ * @param - {int} - the wait status of a command
+ * @return - {int} - the exit code, 128 + the signal for a killed command
+ */
+int sshell_exit_status(int status) {
+    return WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status);
+}
+
+/*
+ * This function find the last command in the job
+ * @param - {const sshell_job *} - the job
+ * @return - {sshell_command *} - the last command, NULL for an empty job
+ */
+struct sshell_command *sshell_last_command(const struct sshell_job *job) {
+    /* empty job */
+    struct sshell_command *node = job->first_command;
+    if(node == NULL) {
+        return NULL;
+    }
+
+    while(node->next_command) {
+        node = node->next_command;
+    }
+    return node;
+}
+
+/*
+ * This function checks if the job is finished
+ * @param - {const sshell_job *} - the job
+ * @return - one for finish, zero not finish
+ */
+int sshell_check_finish(const struct sshell_job *job) {
+    struct sshell_command *cmd = job->first_command;
+    int i;
+
+    while(cmd) {
+        if(cmd->finish == 0) {        /* one command is not finished */
+            return SSHELL_NOT_FINISHED;
+        }
+        for(i = 0; i < cmd->num_substitutions; i++) {   /* nor its process substitutions */
+            if(sshell_check_finish(cmd->substitutions[i].job) == SSHELL_NOT_FINISHED) {
+                return SSHELL_NOT_FINISHED;
+            }
+        }
+        for(i = 0; i < cmd->num_branches; i++) {        /* nor its branches */
+            if(sshell_check_finish(cmd->branches[i]) == SSHELL_NOT_FINISHED) {
+                return SSHELL_NOT_FINISHED;
+            }
+        }
+        cmd = cmd->next_command;
+    }
+    return SSHELL_FINISHED;
+}
+
+/*************************************************************
+ *                    REDIRECTIONS                           *
+ *************************************************************/
+
+/*
+ * This function opens the input/output redirection files and connects according std
+ * @param - {const sshell_command *} - the command struct that contains the files info
+ * @return - {int} - error code
+ */
+int sshell_redirect(const struct sshell_command *cmd) {
+    int fd;
+
+    /* input redirection, several input files are fed by the relay */
+    if(cmd->num_input == 1) {
+        fd = open(cmd->input_file[0], O_RDONLY);
+        if(fd < 0) {             /* files of cached jobs are only checked here */
+            return SSHELL_ERR_OPEN_INPUTFILE;
+        }
+        dup2(fd, STDIN_FILENO);
+        close(fd);               /* close unused file */
+    }
+
+    /* output redirection, several output files are fanned out by a relay */
+    if(cmd->num_output == 1) {
+        fd = open(cmd->output_file[0], O_WRONLY | O_CREAT |
+            (cmd->output_append[0] ? O_APPEND : O_TRUNC), S_IRUSR | S_IWUSR); /* create the file if not exist */
+        if(fd < 0) {
+            return SSHELL_ERR_OPEN_OUTPUTFILE;
+        }
+        dup2(fd, STDOUT_FILENO);
+        close(fd);               /* close unused file */
+    }
+    return SSHELL_SUCCESS;
+}
+
+/*
+ * This function opens every input file of the command for the relay
+ * @param - {const sshell_command *} - the command struct that contains the files info
+ *        - {int *} - the array for the file descriptors
+ * @return - {int} - error code
+ */
+static int open_input_files(const struct sshell_command *cmd, int *fds) {
+    int i;
+
+    for(i = 0; i < cmd->num_input; i++) {
+        fds[i] = open(cmd->input_file[i], O_RDONLY);
+        if(fds[i] < 0) {
+            while(i > 0) {
+                close(fds[--i]);
+            }
+            return SSHELL_ERR_OPEN_INPUTFILE;
+        }
+    }
+    return SSHELL_SUCCESS;
+}
+
+/*
+ * This function opens every output file of the command for the relay
+ * @param - {const sshell_command *} - the command struct that contains the files info
+ *        - {int *} - the array for the file descriptors
+ * @return - {int} - error code
+ */
+static int open_output_files(const struct sshell_command *cmd, int *fds) {
+    int i;
+
+    for(i = 0; i < cmd->num_output; i++) {
+        /* splice() refuses O_APPEND files, splice_all() then writes them: >> never overwrites
+           another writer appending to the file */
+        fds[i] = open(cmd->output_file[i], O_WRONLY | O_CREAT |
+            (cmd->output_append[i] ? O_APPEND : O_TRUNC), S_IRUSR | S_IWUSR);
+        if(fds[i] < 0) {
+            while(i > 0) {
+                close(fds[--i]);
+            }
+            return SSHELL_ERR_OPEN_OUTPUTFILE;
+        }
+    }
+    return SSHELL_SUCCESS;
+}
+
+/*
+ * This function moves the given number of bytes out of a pipe, copying through
+ *  user space only if the target cannot be spliced to
+ * @param - {int} - read end of the pipe
+ *        - {int} - the target file
+ *        - {size_t} - number of bytes to move
+ * @return - {size_t} - zero on success, the bytes left in the pipe on error
+ */
+static size_t splice_all(int in_fd, int out_fd, size_t length) {
+    char buffer[4096];
+    ssize_t n;
+
+    while(length > 0) {
+        n = splice(in_fd, NULL, out_fd, NULL, length, SPLICE_F_MOVE);
+        if(n < 0 && errno == EINVAL) {                  /* the target does not support splice */
+            n = read(in_fd, buffer, length < sizeof(buffer) ? length : sizeof(buffer));
+            if(n > 0) {
+                n = write(out_fd, buffer, n);
+            }
+        }
+        if(n < 0 && errno == EINTR) {
+            continue;
+        }
+        if(n <= 0) {
+            return length;
+        }
+        length -= n;
+    }
+    return 0;
+}
+
+/*
+ * This function moves a whole file into a pipe, copying through user space only if
+ *  the file cannot be spliced from
+ * @param - {int} - the file
+ *        - {int} - write end of the pipe
+ * @return - {int} - zero on success, -1 if the pipe was closed
+ */
+static int splice_file(int in_fd, int out_fd) {
+    char buffer[4096];
+    ssize_t n;
+
+    while(1) {
+        n = splice(in_fd, NULL, out_fd, NULL, 1 << 20, SPLICE_F_MOVE | SPLICE_F_MORE);
+        if(n < 0 && errno == EINVAL) {                  /* the file does not support splice */
+            n = read(in_fd, buffer, sizeof(buffer));
+            if(n > 0 && write(out_fd, buffer, n) != n) {
+                return -1;
+            }
+        }
+        if(n < 0 && errno == EINTR) {
+            continue;
+        }
+        if(n == 0) {                                    /* end of file */
+            return 0;
+        }
+        if(n < 0) {
+            return -1;
+        }
+    }
+}
+
+/*
+ * This function feeds the input files one after the other into the pipe of the command
+ * @param - {int} - write end of the pipe
+ *        - {const int *} - the input files
+ *        - {int} - number of input files
+ * @return - none
+ */
+static void feed_input(int out_fd, const int *in_fds, int num_input) {
+    int i;
+
+    signal(SIGPIPE, SIG_IGN);                           /* the command may stop reading early */
+    for(i = 0; i < num_input; i++) {
+        if(splice_file(in_fds[i], out_fd) < 0) {
+            break;
+        }
+    }
+    for(i = 0; i < num_input; i++) {
+        close(in_fds[i]);
+    }
+    close(out_fd);
+}
+
+/*
+ * This function copies everything read from the pipe to every output file until end of file:
+ *  tee() duplicates the pipe buffers into a scratch pipe for each file but the last,
+ *  and splice() moves them to the files, so no data is copied to user space
+ * @param - {int} - read end of the pipe
+ *        - {const int *} - the output files
+ *        - {int} - number of output files
+ * @return - none
+ */
+static void relay_output(int in_fd, const int *out_fds, int num_output) {
+    int targets[SSHELL_MAX_ARGS], scratch[2];
+    int i, null_fd = open("/dev/null", O_WRONLY), num_open = num_output;
+    ssize_t n;
+    size_t left;
+
+    /* a file that fails is replaced by /dev/null so the others keep the stream, until none is left */
+    memcpy(targets, out_fds, num_output * sizeof(int));
+    if(pipe(scratch) < 0) {
+        close(null_fd);
+        return;
+    }
+    fcntl(scratch[1], F_SETPIPE_SZ, fcntl(in_fd, F_GETPIPE_SZ));    /* whatever is in the pipe fits */
+
+    while(1) {
+        /* duplicate the pending data for the first file, waiting for it if needed */
+        n = tee(in_fd, scratch[1], INT_MAX, 0);
+        if(n < 0 && errno == EINTR) {
+            continue;
+        }
+        if(n <= 0) {                                    /* end of file */
+            break;
+        }
+
+        for(i = 0; i < num_output - 1; i++) {
+            if(i > 0) {
+                tee(in_fd, scratch[1], n, 0);           /* the same bytes again for the next file */
+            }
+            left = splice_all(scratch[0], targets[i], n);
+            if(left > 0) {                              /* drop what the file did not take */
+                num_open -= targets[i] != null_fd;
+                targets[i] = null_fd;
+                splice_all(scratch[0], null_fd, left);
+            }
+        }
+
+        /* the last file consumes the data */
+        left = splice_all(in_fd, targets[num_output - 1], n);
+        if(left > 0) {
+            num_open -= targets[num_output - 1] != null_fd;
+            targets[num_output - 1] = null_fd;
+            splice_all(in_fd, null_fd, left);
+        }
+        if(num_open == 0) {                             /* the writer gets a broken pipe */
+            break;
+        }
+    }
+    close(scratch[0]);
+    close(scratch[1]);
+    close(null_fd);
+}
+
+/*
+ * This function splits a child with several input or output files in two: the command, which
+ *  returns to run, and the relay, which stays the process the caller waits for. The relay feeds
+ *  the input files in order and fans the output out, then leaves with the command status
+ * @param - {const sshell_command *} - the command struct that contains the files info
+ *        - {int} - write end of the error pipe, kept by the command only
+ *        - {int} - one to forward SIGTERM and SIGHUP to the command, when no process group
+ *          of the job carries them to it
+ * @return - none, only the command returns
+ */
+static void supervise(const struct sshell_command *cmd, int error_fd, int forward) {
+    struct sigaction action;
+    int in_fd[2], out_fd[2], in_fds[SSHELL_MAX_ARGS], out_fds[SSHELL_MAX_ARGS];
+    int i, status, error_code;
+    int feed = cmd->num_input > 1, fan_out = cmd->num_output > 1;
+    pid_t pid, feeder = -1;
+
+    error_code = feed ? open_input_files(cmd, in_fds) : SSHELL_SUCCESS;
+    if(error_code == SSHELL_SUCCESS && fan_out &&
+        (error_code = open_output_files(cmd, out_fds)) != SSHELL_SUCCESS) {
+        for(i = 0; feed && i < cmd->num_input; i++) {
+            close(in_fds[i]);
+        }
+    }
+    if(error_code != SSHELL_SUCCESS) {
+        child_error(error_fd, error_code);
+    }
+
+    if((feed && pipe(in_fd) < 0) || (fan_out && pipe(out_fd) < 0)) {
+        child_error(error_fd, SSHELL_ERR_FORK);
+    }
+    pid = fork();
+    if(pid == 0) {                                      /* the command reads from and writes to the relay */
+        if(feed) {
+            close(in_fd[1]);
+            dup2(in_fd[0], STDIN_FILENO);
+            close(in_fd[0]);
+            for(i = 0; i < cmd->num_input; i++) {
+                close(in_fds[i]);
+            }
+        }
+        if(fan_out) {
+            close(out_fd[0]);
+            dup2(out_fd[1], STDOUT_FILENO);
+            close(out_fd[1]);
+            for(i = 0; i < cmd->num_output; i++) {
+                close(out_fds[i]);
+            }
+        }
+        return;
+    } else if(pid < 0) {
+        child_error(error_fd, SSHELL_ERR_FORK);
+    }
+
+    /* the relay: the caller must not wait for it to learn the command started */
+    if(forward) {
+        relayed_command = pid;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = forward_signal;
+        action.sa_flags = SA_RESTART;                   /* the relay goes on until the command exits */
+        sigaction(SIGTERM, &action, NULL);
+        sigaction(SIGHUP, &action, NULL);
+    }
+    close(error_fd);
+    close(STDIN_FILENO);                                /* the previous command must see the command exit */
+    if(feed) {
+        close(in_fd[0]);
+    }
+    if(fan_out) {
+        close(out_fd[1]);
+    }
+    if(feed && fan_out) {                               /* feeding and relaying must not block each other */
+        feeder = fork();
+        if(feeder == 0) {
+            close(out_fd[0]);
+            feed_input(in_fd[1], in_fds, cmd->num_input);
+            _exit(EXIT_SUCCESS);
+        }
+        close(in_fd[1]);
+        for(i = 0; i < cmd->num_input; i++) {
+            close(in_fds[i]);
+        }
+    } else if(feed) {
+        feed_input(in_fd[1], in_fds, cmd->num_input);
+    }
+    if(fan_out) {
+        relay_output(out_fd[0], out_fds, cmd->num_output);
+    }
+
+    if(feeder > 0) {
+        waitpid(feeder, NULL, 0);
+    }
+    waitpid(pid, &status, 0);
+    _exit(sshell_exit_status(status));
+}
+
+/*
+ * This function passes the signal the relay got on to its command
+ * @param - {int} - the signal
+ * @return - none
+ */
+static void forward_signal(int sig) {
+    kill(relayed_command, sig);
+}
+
+/*
+ * This function starts a relay child for a command the caller runs itself with several output files
+ * @param - {const sshell_command *} - the command struct that contains the files info
+ *        - {int *} - the error code
+ * @return - {pid_t} - the relay to wait for once the output is restored, -1 on error
+ */
+pid_t sshell_start_relay(const struct sshell_command *cmd, int *error_code) {
+    int fd[2], out_fds[SSHELL_MAX_ARGS];
+    int i;
+    pid_t pid;
+
+    *error_code = open_output_files(cmd, out_fds);
+    if(*error_code != SSHELL_SUCCESS) {
+        return -1;
+    }
+
+    if(pipe(fd) < 0 || (pid = fork()) < 0) {
+        for(i = 0; i < cmd->num_output; i++) {
+            close(out_fds[i]);
+        }
+        *error_code = SSHELL_ERR_FORK;
+        return -1;
+    }
+    if(pid == 0) {                                      /* the relay */
+        close(fd[1]);
+        relay_output(fd[0], out_fds, cmd->num_output);
+        _exit(EXIT_SUCCESS);
+    }
+
+    close(fd[0]);
+    for(i = 0; i < cmd->num_output; i++) {
+        close(out_fds[i]);
+    }
+    dup2(fd[1], STDOUT_FILENO);                         /* the command writes to the relay */
+    close(fd[1]);
+    return pid;
+}
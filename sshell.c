@@ -1,119 +1,456 @@
+#define _GNU_SOURCE                 /* splice() */
 #include <stdio.h>
+#include <ctype.h>
 #include <string.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <unistd.h> 
 #include <sys/wait.h>
 #include <fcntl.h>
+#include <sys/stat.h>
+#include <signal.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/sendfile.h>
+#include <dirent.h>
+
+#include "sshell.h"
 
 /*************************************************************
  *                    MACRO DEFINITIONS                      *
  *************************************************************/
 
-#define MAX_CMD 512
-#define MAX_ARGS 16
+#define MAX_CMD SSHELL_MAX_CMD
+#define MAX_ARGS SSHELL_MAX_ARGS
+#define MAX_JOBS 128
+#define BUILTIN_BUCKETS 64
+#define KILL_GRACE 5.0              /* seconds from SIGTERM to SIGKILL for a timed out job */
+#define MAX_EVENTS 64
+#define THROTTLE_INTERVAL 1.0      /* seconds between two launches of deferred jobs */
+#define CACHE_SIZE (256LL << 20)    /* bytes the result cache may take by default */
+#define CACHE_KEY 33                /* hex digits of a cache key and the null */
+#define CACHE_FOOTER 9              /* "%08x\n": length of the trailer of a cache entry */
+#define MAX_TAG 64                  /* longest request tag of the server */
+#define SERVE_PENDING 64            /* requests of a client queued or running before its socket is not read */
+#define SERVE_OUTBOX (1 << 20)      /* bytes waiting for a client before its captured output is not read */
+#define SERVE_CHUNK 65536           /* bytes of captured output read at once */
+#define RING_SIZE (64 << 10)        /* bytes of output kept per background job by default */
+#define RING_TOTAL (1 << 20)        /* bytes all the rings may take by default */
+#define RING_MIN 4096               /* first allocation of a ring */
+#define RING_CHUNK 65536            /* bytes of output read from a job at once */
 
 /*************************************************************
  *                    STRUCT and ENUM DEFINITIONS            *
  *************************************************************/
 
-/* parsing option code */
+/* error code of the shell, after the error codes of the library */
 enum {
-    ARGUMENT,
-    INPUT,
-    OUTPUT
+    ERR_DIR_NOTFOUND = SSHELL_NUM_ERRORS,
+    ERR_ACTIVE_JOBS,
+    ERR_UNTERMINATED_BLOCK,
+    ERR_NO_SUCH_JOB,
+    ERR_INVALID_SIGNAL,
+    ERR_INVALID_DURATION,
+    ERR_INVALID_SIZE,
+    ERR_INVALID_PERCENTAGE,
+    ERR_NOT_CAPTURED,
+    ERR_INVALID_FORMAT
 }; 
 
-/* finish code */
+/* builtin command flag */
 enum {
-    NOT_FINISHED,
-    FINISHED
+    BUILTIN_CHILD,                  /* can run in the shell or in a child without exec */
+    BUILTIN_SHELL                   /* changes the shell: always runs in the shell */
 };
 
-/* error code */
+/* tree node code */
 enum {
-    SUCCESS,
-    FAILURE,
-    ERR_INVALID_CMDLINE,
-    ERR_CMD_NOTFOUND,
-    ERR_DIR_NOTFOUND,
-    ERR_OPEN_INPUTFILE,
-    ERR_OPEN_OUTPUTFILE,
-    ERR_NO_INPUTFILE,
-    ERR_NO_OUTPUTFILE,
-    ERR_INPUT_MISLOCATED,
-    ERR_OUTPUT_MISLOCATED,
-    ERR_BACKGROUND_MISLOCATED,
-    ERR_ACTIVE_JOBS
-}; 
+    NODE_JOB,
+    NODE_IF,
+    NODE_WHILE,
+    NODE_FOR,
+    NODE_FUNCTION
+};
+
+/* list connector code: how the node after a node of a list runs */
+enum {
+    LIST_END,                       /* not in a list, or its last node */
+    LIST_SEQUENCE,                  /* ; or &: always */
+    LIST_AND,                       /* &&: if the node succeeded */
+    LIST_OR                         /* ||: if the node failed */
+};
 
-/* builtin command code enum */
+/* event source code of the server */
 enum {
-    EXIT,
-    CD,
-    PWD,
-    NOT_BUILTIN
+    SOURCE_LISTEN,
+    SOURCE_SIGNAL,
+    SOURCE_CLIENT,
+    SOURCE_CAPTURE
+};
+
+/* pipe meter struct: filled by the meter process relaying one pipe of a job */
+struct pipe_meter {
+    long long bytes;                /* bytes moved through the pipe */
+    double writer_wait;             /* seconds waiting for the writing command */
+    double reader_wait;             /* seconds waiting for the reading command */
+    double elapsed;                 /* seconds from the start to the end of the pipe */
+    long long fill_sum;             /* sum of the sampled fill levels */
+    long long fill_max;             /* highest sampled fill level */
+    long long samples;              /* number of fill samples */
+    long long capacity;             /* capacity of the pipe */
+    pid_t pid;                      /* the meter process, zero if none */
+};
+
+/* throttle struct: background jobs wait while the pressure stall information is over the limits */
+struct throttle {
+    char memory_path[PATH_MAX];     /* PSI file of the memory, /proc/pressure/memory or memory.pressure of a cgroup */
+    char cpu_path[PATH_MAX];        /* PSI file of the cpu */
+    double memory_limit;            /* some avg10 percentage over which launches wait, zero for no limit */
+    double cpu_limit;               /* same for the cpu */
+    double interval;                /* seconds between two launches of deferred jobs */
+    double memory;                  /* the last reading of the memory, -1 if unavailable */
+    double cpu;                     /* the last reading of the cpu, -1 if unavailable */
+    int timer_fd;                   /* ticks every interval while jobs wait, -1 if none */
+    int due;                        /* one once the timer ticked */
+    int launching;                  /* one while deferred jobs are launched */
+    struct sshell_job *first_deferred;  /* the jobs waiting to start, in order */
+    struct sshell_job *last_deferred;   /* the last job waiting */
+    long num_deferred;              /* jobs that had to wait */
+};
+
+/* output struct: the background jobs write to rings kept by the shell, not to the terminal */
+struct output {
+    int enabled;                    /* one to capture the output of new background jobs */
+    size_t ring_size;               /* bytes a ring may keep */
+    size_t max_size;                /* bytes all the rings may take */
+    size_t used;                    /* bytes taken by the rings */
+    int epoll_fd;                   /* epoll set of the pipes of the rings, in the one of the shell, -1 if none */
+    int num_open;                   /* pipes still open */
+    struct sshell_job *first_kept;  /* finished jobs whose tail was not read yet, oldest first */
+};
+
+/* ring struct: the tail of the stdout and stderr of a background job */
+struct ring {
+    char *data;                     /* NULL until the job writes */
+    size_t capacity;                /* bytes allocated, grown up to the ring size */
+    size_t start;                   /* offset of the oldest byte kept */
+    size_t length;                  /* bytes kept */
+    long long total;                /* bytes written by the job */
+    int fd;                         /* non-blocking read end of the pipe, -1 once closed */
+    int write_fd;                   /* write end given to the children while the job starts, -1 otherwise */
+    int unread;                     /* one once bytes came in after the tail was last written out */
+    int kept;                       /* one once the job finished and only its tail is left */
+};
+
+/* result cache struct: where the results of the cached jobs are kept, and how it went */
+struct cache {
+    char dir[PATH_MAX - 64];        /* the directory of the entries, with room for their names */
+    long long max_size;             /* bytes the entries may take */
+    long long size;                 /* bytes of the entries, counted once by load_cache() */
+    long serial;                    /* number of the next capture file */
+    long hits;                      /* jobs replayed from the cache */
+    long misses;                    /* cached jobs that had to run */
+    long stores;                    /* results stored */
+    long evictions;                 /* entries evicted */
 };
 
-/* command strcut */
-struct command {
-    pid_t pid;                      /* the process id */
-    int status;                     /* exit status */
-    char command[MAX_CMD];          /* the whole command */
-    char *args[MAX_ARGS];           /* arguments of the command */
-    int num_input;                  /* number of input redirection */
-    int num_output;                 /* number of output redirection */
-    char *input_file[MAX_ARGS];     /* the array of the input files */
-    char *output_file[MAX_ARGS];    /* the array of the output files */
-    int num_args;                   /* number of arguments in the command line */
-    struct command *next_command;   /* the comamnd for pipeling */
-    int finish;                     /* finish flag */
-    int background;                 /* number of background signs */
+/* cache entry struct: an entry found in the directory of the cache */
+struct cache_entry {
+    char name[CACHE_KEY];           /* the key of the entry */
+    struct timespec used;           /* when it was last stored or replayed */
+    long long size;                 /* bytes of the entry */
 };
 
-/* job struct */
-struct job {
-    char commandline[MAX_CMD];      /* the total command line */
-    struct command *first_command;  /* the first command of a job */
-    int num_processes;              /* the number of commands/processes */
-    struct job *next_job;           /* the previous job that was running in background */
-    int finish;                     /* finish flag */
+/* job state struct: what the shell keeps for a job, in the data of the job */
+struct job_state {
+    int id;                         /* the job id used by %n, zero if none */
+    struct pipe_meter *meters;      /* shared with the meters of the pipes, NULL if not metered */
+    double timeout;                 /* seconds the job may run, zero for no timeout */
+    double grace;                   /* seconds from SIGTERM to SIGKILL once timed out */
+    int timer_fd;                   /* the timerfd of the timeout, -1 if none */
+    int timed_out;                  /* zero, one once terminated, two once killed */
+    struct cache *cache;            /* the cache of the result of the job, NULL if not cached */
+    char cache_key[CACHE_KEY];      /* the key of the result */
+    char *capture;                  /* the file capturing the output for the cache, NULL if none */
+    int deferred;                   /* one while the job waits for the pressure to fall, two once it started */
+    int cwd_fd;                     /* the working directory of a deferred job, -1 if none */
+    struct output *output;          /* the rings of the shell, NULL if the output is not captured */
+    struct ring ring;               /* the captured output */
 };
 
 /* job list struct */
 struct job_list {
-    struct job *first_job;          /* the first job of the job list */
+    struct sshell_job *first_job;   /* the first job of the job list */
+    struct sshell_job *table[MAX_JOBS]; /* the jobs indexed by job id */
+    struct sshell_job *current;     /* the most recent background or stopped job */
+};
+
+/* tree node struct: a job or a control flow construct parsed once */
+struct node {
+    int type;                       /* tree node code */
+    struct sshell_job *job;         /* the job, the condition, or the for/function header */
+    struct node *body;              /* the then/loop/function body */
+    struct node *else_body;         /* the else (or elif) branch */
+    char *words;                    /* the words of a for loop, expanded when it runs */
+    int connector;                  /* list connector code */
+    struct node *next_node;         /* the next node of the block */
+    struct node *next_tree;         /* the next tree kept by the shell */
+};
+
+/* function struct */
+struct function {
+    char name[MAX_CMD];             /* the name of the function */
+    struct node *body;              /* the cached body of the function */
+    struct function *next_function; /* the next defined function */
+};
+
+struct shell;
+
+/* builtin command struct */
+struct builtin {
+    const char *name;               /* the name of the command */
+    int (*run)(struct shell *shell, struct sshell_job *job, struct sshell_command *cmd);
+    int flag;                       /* builtin command flag */
+    struct builtin *next_builtin;   /* the next builtin of the hash bucket */
+};
+
+/* shell struct */
+struct shell {
+    struct job_list *job_list;      /* the active jobs */
+    struct function *first_function;/* the defined functions */
+    struct node *first_tree;        /* the trees kept alive for their functions */
+    char **positional;              /* the arguments of the running function */
+    int num_positional;             /* number of positional arguments */
+    int last_status;                /* exit status of the last job */
+    int exiting;                    /* exit flag */
+    int in_list;                    /* depth of the lists running, they report their jobs once */
+    int interactive;                /* one if the shell controls the terminal */
+    int meter;                      /* one to meter the pipes of new jobs */
+    pid_t pgid;                     /* the process group of the shell */
+    int events_fd;                  /* epoll set of the job timers and of the child signals */
+    int signal_fd;                  /* signalfd reading SIGCHLD */
+    sigset_t signal_mask;           /* the signal mask given back to the children */
+    double background_timeout;      /* timeout of background jobs without one, zero for none */
+    struct cache cache;             /* the result cache */
+    struct throttle throttle;       /* the throttle of the background jobs */
+    struct output output;           /* the rings of the background jobs */
+    struct builtin *builtins[BUILTIN_BUCKETS];  /* the builtin commands hashed by name */
+};
+
+/* event source struct: the first member of everything the epoll set of the server points to */
+struct source {
+    int type;                       /* event source code */
+    int fd;                         /* the file descriptor in the epoll set, -1 if closed */
+};
+
+struct server;
+
+/* client struct: one connection to the server */
+struct client {
+    struct source socket;           /* the connection */
+    char input[MAX_TAG + MAX_CMD + 4];  /* the incomplete request line */
+    size_t input_len;               /* length of the incomplete request line */
+    char *output;                   /* the replies the socket did not take yet */
+    size_t output_len;              /* bytes of replies waiting */
+    size_t output_size;             /* size of the reply buffer */
+    int pending;                    /* requests of the client queued or running */
+    int eof;                        /* one once the client sends nothing more */
+    int dead;                       /* one once the connection broke, replies are dropped */
+    int discarding;                 /* one while the rest of a rejected line is dropped */
+    struct client *next_client;     /* the next client of the server */
+};
+
+/* request struct: one command line sent to the server */
+struct request {
+    struct source capture;          /* read end of the pipe of the captured output, -1 if none */
+    int captured;                   /* one to send the output back to the client */
+    int capture_out;                /* write end of that pipe while the job starts */
+    int paused;                     /* one while the captured output waits for the client */
+    char tag[MAX_TAG];              /* the name the client gave the request */
+    char line[MAX_CMD];             /* the command line */
+    struct sshell_job *job;         /* the job, NULL while queued */
+    struct client *client;          /* the client waiting for the request */
+    struct server *server;          /* the server running it */
+    struct request *next_request;   /* the next request of the queue or of the running list */
+};
+
+/* server struct */
+struct server {
+    struct shell *shell;            /* the shell of the builtin commands */
+    struct source listen;           /* the listening socket */
+    struct source signal;           /* signalfd reading SIGCHLD, SIGTERM and SIGINT */
+    int events_fd;                  /* epoll set of the sockets, the captured outputs and the signals */
+    int max_jobs;                   /* number of jobs running at once */
+    int running;                    /* number of jobs running */
+    int stopping;                   /* one once asked to stop */
+    const char *path;               /* the path of the listening socket */
+    struct request *first_queued;   /* the requests waiting for a free job */
+    struct request *last_queued;    /* the last request of the queue */
+    struct request *first_running;  /* the requests running */
+    struct client *first_client;    /* the connections */
 };
 
 /*************************************************************
  *                    LOCAL FUNCTION PROTOTYPES              *
  *************************************************************/
 
-void insert_job(struct job **root, struct job *job);
+void insert_job(struct sshell_job **root, struct sshell_job *job);
 void free_job_list(struct job_list *job_list);
-void delete_job(struct job **root, struct job *job);
-struct command* find_last_command(struct command *cmd);
-int check_finish_job(struct job* job);
-void insert_command(struct command **root, struct command *cmd);
-void insert_status(struct job *job, pid_t pid, int status);
-struct job *read_job();
-struct command* read_command(char *command);
-void pipeline(struct command *cmd, int fd[2], struct job_list* job_list);
-void free_job(struct job *job);
-void free_command(struct command *cmd);
+void unlink_job(struct sshell_job **root, struct sshell_job *job);
+void delete_job(struct sshell_job **root, struct sshell_job *job);
+struct sshell_job *insert_status(struct sshell_job *job, pid_t pid, int status);
+void add_job_id(struct job_list *job_list, struct sshell_job *job);
+void remove_job_id(struct job_list *job_list, struct sshell_job *job);
+struct sshell_job *find_job(struct job_list *job_list, const char *spec, const struct sshell_job *self);
+int read_line(struct shell *shell, char *line);
+struct sshell_job *attach_state(struct sshell_job *job);
+struct sshell_job *parse_job(const char *line);
+struct sshell_job *clone_job(const struct sshell_job *job);
+struct job_state *job_state(const struct sshell_job *job);
+char *match_keyword(char *line, const char *keyword);
+int is_function_header(const char *line, char *name);
+int is_block_keyword(char *line);
+struct node *new_node(int type, struct sshell_job *job);
+struct sshell_job *parse_block_job(char *line, int *error_code);
+struct node *parse_block(struct shell *shell, const char **ends, char *terminator, int *error_code);
+struct node *parse_if(struct shell *shell, char *condition, int *error_code);
+struct node *parse_node(struct shell *shell, char *line, int *error_code);
+int skip_enclosed(const char *line, int i);
+int is_list(const char *line);
+struct node *parse_list(char *line, int *error_code);
+void free_node(struct node *node);
+int contains_function(const struct node *node);
+struct function *find_function(struct shell *shell, const char *name);
+void define_function(struct shell *shell, const char *name, struct node *body);
+int call_function(struct shell *shell, struct function *function, struct sshell_command *cmd);
+char *expand_word(struct shell *shell, const char *word);
+char **expand_words(struct shell *shell, const char *line, int *num_words);
+void expand_job(struct shell *shell, struct sshell_job *job);
+void expand_string(struct shell *shell, const struct sshell_job *job, char **word);
+int execute_node(struct shell *shell, struct node *node);
+int execute_list(struct shell *shell, struct node **list);
+void report_jobs(struct shell *shell, struct sshell_job *job_end);
+int execute_cached_job(struct shell *shell, const struct sshell_job *job);
+int execute_job(struct shell *shell, struct sshell_job *job);
+void run_line(struct shell *shell, char *line);
+int hook_in_caller(void *data, struct sshell_job *job, struct sshell_command *cmd);
+void hook_in_child(void *data, struct sshell_job *job, struct sshell_command *cmd);
+int hook_run_in_child(void *data, struct sshell_job *job, struct sshell_command *cmd);
+int hook_on_pipe(void *data, struct sshell_job *job, struct sshell_command *cmd, int read_fd);
+double now();
+int start_meter(struct shell *shell, struct sshell_job *job, struct sshell_command *cmd, int in_fd);
+void meter_pipe(int in_fd, int out_fd, struct pipe_meter *meter);
+void meter_message(struct sshell_job *job);
+int builtin_meter(struct shell *shell, struct sshell_job *self, struct sshell_command *cmd);
+void init_job_control(struct shell *shell);
+void init_events(struct shell *shell);
+int parse_duration(const char *word, double *seconds);
+int read_timeout(struct sshell_job *job);
+int arm_timer(struct shell *shell, struct sshell_job *job, double seconds);
+void disarm_timer(struct sshell_job *job);
+void expire_job(struct shell *shell, struct sshell_job *job);
+int timers_armed(struct job_list *job_list);
+int jobs_running(struct job_list *job_list);
+int events_pending(struct shell *shell);
+int wait_events(struct shell *shell, int fd, int timeout);
+int builtin_timeout(struct shell *shell, struct sshell_job *self, struct sshell_command *cmd);
+void child_setup(struct shell *shell, struct sshell_job *job, int foreground);
+void wait_foreground(struct shell *shell, struct sshell_job *job);
+int wait_job(struct shell *shell, struct sshell_job *job);
+int run_in_shell(struct shell *shell, struct sshell_job *job, struct sshell_command *cmd, const struct builtin *builtin);
+int builtin_jobs(struct shell *shell, struct sshell_job *self, struct sshell_command *cmd);
+int builtin_fg(struct shell *shell, struct sshell_job *self, struct sshell_command *cmd);
+int builtin_bg(struct shell *shell, struct sshell_job *self, struct sshell_command *cmd);
+int builtin_kill(struct shell *shell, struct sshell_job *self, struct sshell_command *cmd);
+int builtin_wait(struct shell *shell, struct sshell_job *self, struct sshell_command *cmd);
+void free_job(struct sshell_job *job);
 int is_empty_command(char *cmd);
-int is_valid_command(struct command *cmd);
-int check_redirection_file(char *file, int mode);
-int check_command(struct command *cmd, int num_processes, int index);
-int check_input_output(struct command *cmd, int num_processes, int index);
-int check_background(struct command *cmd, int num_processes, int index);
-int check_job(struct job *job);
-int is_builtin_command(const struct command *cmd);
-int cd(const char *dir);
-int pwd();
-void redirection(const struct command *cmd);
-void check_background_process(struct job *job_start, struct job *job_end);
+unsigned int hash_name(const char *name);
+void register_builtin(struct shell *shell, const char *name,
+    int (*run)(struct shell *, struct sshell_job *, struct sshell_command *), int flag);
+void init_builtins(struct shell *shell);
+void free_builtins(struct shell *shell);
+const struct builtin *find_builtin(struct shell *shell, const char *name);
+int builtin_exit(struct shell *shell, struct sshell_job *self, struct sshell_command *cmd);
+int builtin_cd(struct shell *shell, struct sshell_job *self, struct sshell_command *cmd);
+int builtin_pwd(struct shell *shell, struct sshell_job *self, struct sshell_command *cmd);
+int builtin_true(struct shell *shell, struct sshell_job *self, struct sshell_command *cmd);
+int builtin_false(struct shell *shell, struct sshell_job *self, struct sshell_command *cmd);
+int builtin_echo(struct shell *shell, struct sshell_job *self, struct sshell_command *cmd);
+int builtin_printf(struct shell *shell, struct sshell_job *self, struct sshell_command *cmd);
+int test_expression(char **args, int num_args);
+int builtin_test(struct shell *shell, struct sshell_job *self, struct sshell_command *cmd);
+void check_background_process(struct sshell_job *job_start, struct sshell_job *job_end);
 void error_message(int error_code);
-void process_complete_message(struct job **first_job);
+void print_errors(const struct sshell_job *job);
+void print_statuses(const struct sshell_job *job);
+void process_complete_message(struct job_list *job_list);
+void init_cache(struct cache *cache);
+void load_cache(struct cache *cache);
+int parse_size(const char *word, long long *size);
+void hash_bytes(unsigned __int128 *hash, const void *data, size_t length);
+void hash_string(unsigned __int128 *hash, const char *string);
+void hash_file(unsigned __int128 *hash, const char *path, int by_mtime);
+int input_in_key(const struct sshell_command *cmd);
+int read_cache(struct shell *shell, struct sshell_job *job);
+void set_cache_key(struct shell *shell, struct sshell_job *job, int i, int by_mtime);
+int copy_range(int in_fd, off_t offset, off_t length, int out_fd);
+int make_dirs(const char *path);
+int lookup_result(struct sshell_job *job);
+void capture_result(struct sshell_job *job);
+void store_result(struct sshell_job *job);
+int list_results(const struct cache *cache, struct cache_entry **entries, long long *total);
+int compare_entries(const void *a, const void *b);
+void evict_results(struct cache *cache, long long max_size);
+int builtin_cache(struct shell *shell, struct sshell_job *self, struct sshell_command *cmd);
+void init_throttle(struct throttle *throttle);
+double read_pressure(const char *path);
+int over_pressure(struct throttle *throttle);
+int throttle_job(struct shell *shell, struct sshell_job *job);
+void run_deferred(struct shell *shell);
+void dequeue_job(struct throttle *throttle, struct sshell_job *job);
+void wait_deferred(struct shell *shell, struct sshell_job *job);
+int start_deferred(struct shell *shell, struct sshell_job *job, int foreground);
+int builtin_throttle(struct shell *shell, struct sshell_job *self, struct sshell_command *cmd);
+void init_output(struct output *output);
+int start_ring(struct shell *shell, struct sshell_job *job);
+void close_ring(struct job_state *state);
+void append_ring(struct output *output, struct ring *ring, const char *data, size_t length);
+void read_ring(struct shell *shell, struct sshell_job *job);
+void drain_rings(struct shell *shell);
+void dump_ring(struct shell *shell, struct sshell_job *job);
+void keep_ring(struct job_list *job_list, struct sshell_job *job);
+void release_ring(struct shell *shell, struct sshell_job *job);
+int builtin_output(struct shell *shell, struct sshell_job *self, struct sshell_command *cmd);
+int serve(struct shell *shell, const char *path, int max_jobs);
+void accept_clients(struct server *server);
+void read_requests(struct server *server, struct client *client);
+void queue_lines(struct server *server, struct client *client);
+void reject_line(struct client *client);
+void discard_line(struct client *client);
+void queue_request(struct server *server, struct client *client, char *line);
+void start_requests(struct server *server);
+void start_request(struct server *server, struct request *request);
+int serve_in_caller(void *data, struct sshell_job *job, struct sshell_command *cmd);
+void serve_in_child(void *data, struct sshell_job *job, struct sshell_command *cmd);
+int serve_run_in_child(void *data, struct sshell_job *job, struct sshell_command *cmd);
+void read_capture(struct server *server, struct request *request);
+void reap_requests(struct server *server);
+void finish_request(struct server *server, struct request *request, const char *failure);
+void stop_server(struct server *server);
+void reply(struct client *client, const char *data, size_t length);
+void reply_output(struct request *request, const char *data, size_t length);
+void update_client(struct server *server, struct client *client);
+void close_clients(struct server *server, int all);
 
 /*************************************************************
  *                    LOCAL FUNCTION DEFINITIONS             *
@@ -121,16 +458,16 @@ void process_complete_message(struct job **first_job);
 
 /*
  * This function inserts the job at the end of the job list
- * @param - {job **} - the root of the job list 
- *        - {job *} - the job to be inserted
+ * @param - {sshell_job **} - the root of the job list 
+ *        - {sshell_job *} - the job to be inserted
  * @return - none
  */
-void insert_job(struct job **root, struct job *job) {
+void insert_job(struct sshell_job **root, struct sshell_job *job) {
     /* the job is empty */
     if(*root == NULL) {
         *root = job;
     } else {
-        struct job *node = *root;
+        struct sshell_job *node = *root;
         /* this will find last node of of the job list */
         while(node->next_job) {
             node = node->next_job;
@@ -147,8 +484,8 @@ void insert_job(struct job **root, struct job *job) {
  * @return - none
  */
 void free_job_list(struct job_list* job_list) {
-    struct job *node;
-    struct job *head = job_list->first_job;     /* initializes the head of the job list */
+    struct sshell_job *node;
+    struct sshell_job *head = job_list->first_job; /* initializes the head of the job list */
 
     while(head != NULL) {
         node = head;                            /* get the current node at the top of the job list */
@@ -159,151 +496,144 @@ void free_job_list(struct job_list* job_list) {
 }
 
 /*
- * This function deletes node in the job list
- * @param - {job **} - the root of the job list
- *        - {job *} - the job to be deleted
+ * This function takes the node out of the job list, without freeing it
+ * @param - {sshell_job **} - the root of the job list
+ *        - {sshell_job *} - the job to be taken out
  * @return - none
  */
-void delete_job(struct job **root, struct job *job) {
-    /* store the root node */
-    struct job *node = *root;
-    struct job *prev;
-
-    /* find the targeted pid */
-    struct command *last_command = find_last_command(job->first_command);
-    pid_t key_id = last_command->pid;
-    last_command = find_last_command(node->first_command);
-    
-    /* remove the head */
-    if(node != NULL && last_command->pid == key_id) {
-        *root = node->next_job;     /* change head */
-        free_job(node);
-        return;
-    }
-
-    /* search for the pid */
-    while(node != NULL && last_command->pid != key_id) {
-        prev = node;
-        node = node->next_job;
-        last_command = find_last_command(node->first_command);
+void unlink_job(struct sshell_job **root, struct sshell_job *job) {
+    /* find the link to the job */
+    struct sshell_job **link = root;
+    while(*link != NULL && *link != job) {
+        link = &((*link)->next_job);
     }
 
     /* cant find it */
-    if(node == NULL)  {
+    if(*link == NULL)  {
         return;
     }
 
-    /* delete the node from the job list */
-    prev->next_job = node->next_job;
-    free_job(node);
+    /* take the node out of the job list */
+    *link = job->next_job;
+    job->next_job = NULL;
 }
 
 /*
- * This function find the last command in the job
- * @param - {command *} - the command
- * @return - {command *}
+ * This function deletes node in the job list
+ * @param - {sshell_job **} - the root of the job list
+ *        - {sshell_job *} - the job to be deleted
+ * @return - none
  */
-struct command* find_last_command(struct command *cmd) {
-    /* empty job */
-    struct command *node = cmd;
-    if(node == NULL) {
-        return NULL;
-    }
-    
-    while(node->next_command) {
-        node = node->next_command;
-    }
-    return node;
+void delete_job(struct sshell_job **root, struct sshell_job *job) {
+    unlink_job(root, job);
+    free_job(job);
 }
 
 /*
- * This function checks if the job is finished
- * @param - {job *} - the job
- * @return - one for finish, zero not finish
+ * This function checks if the command has the same id, if so add status to it
+ * @param - {sshell_job *} - the job list
+ *        - {pid_t} - the id to find 
+ *        - {int} - the exit status of that pid
+ * @return - {sshell_job *} - the job of the command, NULL if not found
  */
-int check_finish_job(struct job* job) {
-    struct command *cmd = job->first_command;
-    while(cmd) {
-        if(cmd->finish == 0) {        /* one command is not finished */
-            return NOT_FINISHED;
+struct sshell_job *insert_status(struct sshell_job *job, pid_t pid, int status) {
+    struct sshell_job *job_node;
+    for(job_node = job; job_node; job_node = job_node->next_job) {
+        if(sshell_record(job_node, pid, status)) {  /* found it and insert the status to the node */
+            return job_node;
         }
-        cmd = cmd->next_command;
     }
-    return FINISHED;
+    return NULL;
 }
 
 /*
- * This function inserts the command at the end of the job list
- * @param - {command **} - the head of the job list
- *    - {command *} - the command to be inserted
+ * This function gives the job the smallest free job id, if it has none yet
+ * @param - {job_list *} - the job list
+ *        - {sshell_job *} - the job
  * @return - none
  */
-void insert_command(struct command **root, struct command *cmd) {
-    /* the job is empty */
-    if(*root == NULL) {
-        *root = cmd;
-    } else {
-        struct command *node = *root;
-        /* this will find last node of of the job list */
-        while(node->next_command) {
-            node = node->next_command;
-        }
-        /* insert the command to the end */
-        node->next_command = cmd;
+void add_job_id(struct job_list *job_list, struct sshell_job *job) {
+    int id;
+    if(job_state(job)->id) {            /* a deferred job keeps the id it got in the queue */
+        return;
+    }
+    for(id = 1; id < MAX_JOBS && job_list->table[id]; id++);
+    if(id < MAX_JOBS) {                 /* the job has no id when the table is full */
+        job_state(job)->id = id;
+        job_list->table[id] = job;
     }
-    return;
 }
 
 /*
- * This function checks if the command has the same id, if so add status to it
- * @param - {job *} - the job list
- *        - {pid_t} - the id to find 
- *        - {int} - the exit status of that pid
+ * This function releases the job id of the job
+ * @param - {job_list *} - the job list
+ *        - {sshell_job *} - the job
  * @return - none
  */
-void insert_status(struct job *job, pid_t pid, int status) {
-    /* the job list is empty */
-    if(job == NULL) {
-        return;
-    } else {
-        struct job *job_node = job;
-        while(job_node) {
-            struct command *cmd_node = job_node->first_command;
-            /* this will find node tha has the pid */
-            while(cmd_node && cmd_node->pid != pid) {
-                cmd_node = cmd_node->next_command;
-            }
-            /* found it and insert the status to the node */
-            if(cmd_node) {
-                cmd_node->status = status;
-                cmd_node->finish = FINISHED;
-                return;
-            } 
-            job_node = job_node->next_job;
+void remove_job_id(struct job_list *job_list, struct sshell_job *job) {
+    if(job_state(job)->id) {
+        job_list->table[job_state(job)->id] = NULL;
+    }
+    if(job_list->current == job) {
+        job_list->current = NULL;
+    }
+}
+
+/*
+ * This function finds the job of a job spec: %n, %% or %+, the current job if no spec. A
+ *  deferred job waiting in the throttle is found too, it has no process group yet
+ * @param - {job_list *} - the job list
+ *        - {const char *} - the job spec
+ *        - {const sshell_job *} - the job running the builtin, never returned
+ * @return - {sshell_job *} - the job, NULL if there is no such job
+ */
+struct sshell_job *find_job(struct job_list *job_list, const char *spec, const struct sshell_job *self) {
+    struct sshell_job *job = NULL;
+    int id;
+
+    if(spec == NULL || strcmp(spec, "%%") == 0 || strcmp(spec, "%+") == 0) {
+        job = job_list->current;
+    } else if(spec[0] == '%') {
+        id = atoi(spec + 1);
+        if(id > 0 && id < MAX_JOBS) {
+            job = job_list->table[id];
         }
-    } 
-    return;
+    }
+    if(job == self || (job && ((job->pgid == 0 && job_state(job)->deferred != 1) || job_state(job)->ring.kept))) {
+        return NULL;                                /* the job has no process to signal */
+    }
+    return job;
 }
 
 /*
- * This function reads the whole command line from terminal and store each command as a linked list
- * @param - none
- * @return - {job *} - the stored job
- */
-struct job* read_job() {
-    char commands[MAX_CMD];
-    char *token, *nl;
-    struct command *cmd;
-  
-    struct job *job = (struct job*) malloc(sizeof(struct job)); /* allocate space for job struct */
-    job->num_processes = 1;                                     /* initialize number of processes */
-    job->next_job = NULL;                                       /* initialize next job to NULL */
-    job->finish = NOT_FINISHED;                                 /* initializes not finish */
-    job->first_command = NULL;                                  /* initialize first job to NULL */
+ * This function reads one command line from terminal, echoing it when it comes from a script
+ * @param - {shell *} - the shell
+ *        - {char *} - the buffer of MAX_CMD characters for the line
+ * @return - {int} - zero on success, EOF when the input is exhausted (the line becomes "exit")
+ */
+int read_line(struct shell *shell, char *line) {
+    char *nl;
+    int code = 0;
+
+    /* the timers of the jobs expire and the deferred jobs start while the terminal is idle */
+    run_deferred(shell);
+    if(shell->interactive && events_pending(shell)) {
+        fflush(stdout);
+        while(!wait_events(shell, STDIN_FILENO, -1)) {
+            run_deferred(shell);
+        }
+    }
 
     /* get the entire command line */
-    if(fgets(commands, MAX_CMD, stdin) == NULL) {               /* in case we reach EOF */
-        strcpy(commands, "exit\n");
+    if(fgets(line, MAX_CMD, stdin) == NULL) {                   /* in case we reach EOF */
+        strcpy(line, "exit\n");
+        code = EOF;
+        /* exit fails while jobs wait or run: start and reap them instead of retrying it */
+        wait_deferred(shell, NULL);
+        while(jobs_running(shell->job_list)) {
+            wait_events(shell, -1, -1);
+            report_jobs(shell, NULL);
+        }
     }
 
     /*
@@ -311,704 +641,4334 @@ struct job* read_job() {
      * the terminal (which is the case with the test script)
      */
     if(!isatty(STDIN_FILENO)) {
-        printf("%s", commands);
+        printf("%s", line);
         fflush(stdout);
     }
     
     /* Remove trailing newline from command line */
-    nl = strchr(commands, '\n');
+    nl = strchr(line, '\n');
     if (nl) {
        *nl = '\0';
     }
-    
-    strcpy(job->commandline, commands);        /* store the whole command line */
+    return code;
+}
 
-    /* find number of processes */
-    int i;
-    for(i = 0; i < strlen(commands); i++) {
-        if(commands[i] == '|') {
-            job->num_processes++;
-        }
-    }
-    
-    token = strtok(commands, "|");             /* get the first command */
-    if(token == NULL) {                        /* no command */
-        job->first_command = NULL;
-        return job;
-    }
-   
-    while(token != NULL) {                     /* one command or more */
-        cmd = read_command(token);
-        insert_command(&(job->first_command), cmd);
-        token = strtok(NULL, "|");
-        cmd = cmd->next_command;    
+/*
+ * This function gives the parsed job the state the shell keeps for it
+ * @param - {sshell_job *} - the job, NULL if it could not be allocated
+ * @return - {sshell_job *} - the job
+ */
+struct sshell_job *attach_state(struct sshell_job *job) {
+    struct job_state *state = job ? (struct job_state*) malloc(sizeof(struct job_state)) : NULL;
+
+    if(state == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
     }
+    state->id = 0;                      /* the job id is given when it runs */
+    state->meters = NULL;               /* initialize not metered */
+    state->timeout = 0;                 /* initialize no timeout */
+    state->grace = KILL_GRACE;          /* initialize the kill grace period */
+    state->timer_fd = -1;               /* initialize no timer */
+    state->timed_out = 0;               /* initialize not timed out */
+    state->cache = NULL;                /* initialize not cached */
+    state->capture = NULL;              /* initialize no capture */
+    state->deferred = 0;                /* initialize not deferred */
+    state->cwd_fd = -1;                 /* initialize no working directory */
+    state->output = NULL;               /* initialize not captured */
+    memset(&state->ring, 0, sizeof(struct ring));
+    state->ring.fd = -1;
+    state->ring.write_fd = -1;
+    job->data = state;
     return job;
-}   
+}
 
 /*
- * This function parses the command and store it as a command struct
- * @param - {char *} - the command to be parsed
- * @return - {command *} - the command struct
+ * This function parses the whole command line and store each command as a linked list
+ * @param - {const char *} - the command line
+ * @return - {sshell_job *} - the stored job
  */
-struct command* read_command(char *command) {
-    char arg[MAX_CMD];
-    int num_white_space;
-    
-    struct command* cmd = (struct command*) malloc(sizeof(struct command));     /* allocate space for comamnd */
-    cmd->num_args = 0;                  /* initialize number of arguments */
-    cmd->num_input = 0;                 /* initialize number of input redirections */
-    cmd->num_output = 0;                /* initialize number of output redirections */
-    cmd->background = 0;                /* initialize number of background signs */
-    cmd->next_command = NULL;           /* next command initializes to null */
-    cmd->finish = NOT_FINISHED;         /* initialize not finish command */
-
-    /* get rid of leading spaces and tabs*/
-    for(num_white_space = 0; command[num_white_space] == ' ' || 
-        command[num_white_space] == '\t'; num_white_space++);
-    
-    command = command + num_white_space;
+struct sshell_job *parse_job(const char *line) {
+    return attach_state(sshell_parse(line, NULL));
+}
 
-    /* get rid of trailing spaces and tabs */
-    int i;
-    for(i = strlen(command) - 1; i >= 0 
-        && (command[i] == ' ' || command[i] == '\t'); i--) {
-        command[i] = 0;
-    }
-    
-    strcpy(cmd->command, command);      /* store command line */
-
-    /* parse the command manually */
-    int read_code = ARGUMENT;
-    i = 0;
-    while(i < strlen(command)) {
-        memset(arg, 0, MAX_CMD);
-        int j = 0;
-
-        /* get the argument */
-        while(command[i] != ' ' && command[i] != '<' && command[i] != '>' 
-            && command[i] != 0 && command[i] != '&') {
-            arg[j++] = command[i++];
-        }
-        arg[j] = 0;             /* add null terminator */
-
-        for(; command[i] == ' ' || command[i] == '\t'; i++);        /* get rid of leading spaces and tabs*/
-      
-        switch(read_code) {
-            case ARGUMENT:      /* an argument for the program */
-                cmd->args[cmd->num_args] = (char *) malloc(strlen(arg) + 1);
-                strcpy(cmd->args[cmd->num_args++], arg);
-                break;
-            case INPUT:         /* input file */
-                if(arg[0] == 0) {
-                    cmd->input_file[cmd->num_input++] = NULL;
-                } else {
-                    cmd->input_file[cmd->num_input] = (char *) malloc(strlen(arg) + 1);
-                    strcpy(cmd->input_file[cmd->num_input++], arg);
-                }
-                read_code = ARGUMENT;
-                break;
-            case OUTPUT:         /* output file */
-                if(arg[0] == 0) {
-                    cmd->output_file[cmd->num_output++] = NULL;
-                } else {
-                    cmd->output_file[cmd->num_output] = (char *) malloc(strlen(arg) + 1);
-                    strcpy(cmd->output_file[cmd->num_output++], arg);
-                }
-                read_code = ARGUMENT;
-                break;
-        }
+/*
+ * This function copies a parsed job so a cached job can run again without parsing
+ * @param - {const sshell_job *} - the job to copy
+ * @return - {sshell_job *} - the copied job
+ */
+struct sshell_job *clone_job(const struct sshell_job *job) {
+    struct sshell_job *copy = attach_state(sshell_clone(job));
 
-        /* check for redirections */
-        if(command[i] == '<') {                                     /* read input file for next argument */
-            read_code = INPUT;
-            i++;
-            for(; command[i] == ' ' || command[i] == '\t'; i++);    /* get rid of leading spaces tabs */
-        } else if(command[i] == '>') {                              /* read output file for next argument */
-            read_code = OUTPUT;
-            i++;
-            for(; command[i] == ' ' || command[i] == '\t'; i++);    /* get rid of leading spaces and tabs */
-        } else if(command[i] == '&') {
-            cmd->background++;
-            i++;
-            for(; command[i] == ' ' || command[i] == '\t'; i++);    /* get rid of leading spaces and tabs */
-        }
-    }
-    
-    /* check given files */
-    if(read_code == INPUT) {
-        cmd->input_file[cmd->num_input++] = NULL;                   /* use null to indicate not given file */
-    } else if (read_code == OUTPUT) {
-        cmd->output_file[cmd->num_output++] = NULL;                 /* use null to indicate not given file */   
-    }
-    
-    cmd->args[cmd->num_args] = NULL;                                /* set null terminator */
-    return cmd;
+    job_state(copy)->timeout = job_state(job)->timeout;
+    job_state(copy)->grace = job_state(job)->grace;
+    return copy;
 }
 
 /*
- * This function pipelines the commands: connects the old's reading stream and creates new pipe for next process
- * @param - {command *} - the pipeline commands
- *    - {int [2]} - old pipe
- *    - {job_list *} - the job list: to check if there is any active job
- * @return - none
+ * This function gets the state the shell keeps for the job
+ * @param - {const sshell_job *} - the job
+ * @return - {job_state *} - the state
+ */
+struct job_state *job_state(const struct sshell_job *job) {
+    return (struct job_state*) job->data;
+}
+
+/*
+ * This function gets the time of the monotonic clock
+ * @param - none
+ * @return - {double} - the time in seconds
  */
-void pipeline(struct command *cmd, int fd[2], struct job_list *job_list) {
-    int builtin_command_code, status;
-    int new_fd[2];
+double now() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+/*
+ * This function starts the meter process between the command and the next one
+ * @param - {shell *} - the shell
+ *        - {sshell_job *} - the metered job
+ *        - {sshell_command *} - the command writing to the pipe
+ *        - {int} - read end of the pipe the command writes to
+ * @return - {int} - read end of the pipe for the next command
+ */
+int start_meter(struct shell *shell, struct sshell_job *job, struct sshell_command *cmd, int in_fd) {
+    struct sshell_command *node;
+    int out_fd[2];
+    int index = 0;
     pid_t pid;
-    
-    /* creates new pipe */
-    if(cmd->next_command) {
-        pipe(new_fd);
-    }
 
-    /* check if it is a built in command */
-    builtin_command_code = is_builtin_command(cmd);
+    for(node = job->first_command; node && node != cmd; node = node->next_command) {
+        index++;
+    }
+    if(node == NULL) {                                  /* a pipe of a process substitution */
+        return in_fd;
+    }
 
-    /* check if it is builtin command */
-    if(builtin_command_code == EXIT) {                  /* leave the shell */
-        if(job_list->first_job->next_job != NULL) {     /* try to exit while there are active jobs */
-            status = EXIT_FAILURE;
-            error_message(ERR_ACTIVE_JOBS);
-        } else {                                        /* can exit */
-            fprintf(stderr, "Bye...\n");
-            free_job_list(job_list);
-	    
-	    /* close out file */
-	    close(fd[0]);
-	    if(cmd->next_command) {
-	        close(new_fd[0]);
-	        close(new_fd[1]);
-	    }
-     	    exit(EXIT_SUCCESS);
-        }
+    pipe(out_fd);
+    pid = fork();
+    if(pid == 0) {                                      /* the meter */
+        child_setup(shell, job, sshell_last_command(job)->background == 0);
+        close(out_fd[0]);
+        meter_pipe(in_fd, out_fd[1], &(job_state(job)->meters[index]));
+        _exit(EXIT_SUCCESS);
+    } else if(pid < 0) {                                /* fork error: the pipe goes unmetered */
+        close(out_fd[0]);
+        close(out_fd[1]);
+        return in_fd;
     }
-    else if(builtin_command_code == CD) {               /* run cd command */
-        status = cd(cmd->args[1]);
 
-    } else if(builtin_command_code == PWD) {            /* run pwd command */
-        status = pwd();
+    if(job->grouped) {
+        setpgid(pid, job->pgid);
     }
+    job_state(job)->meters[index].pid = pid;
+    close(in_fd);
+    close(out_fd[1]);
+    return out_fd[0];
+}
 
-    pid = fork();
-    cmd->pid = pid;
-    /* last command of the pipeline */
-    if(pid == 0) {
-        /* child */
-        dup2(fd[0], STDIN_FILENO);                      /* replace new read stream with old read stream */ 
-        close(fd[0]);                                   /* close unnecessary files */
+/*
+ * This function relays one pipe of a job with splice() and measures it: the time spent waiting
+ *  for the writing command, the time spent waiting for the reading command and the fill level
+ * @param - {int} - read end of the pipe from the writing command
+ *        - {int} - write end of the pipe to the reading command
+ *        - {pipe_meter *} - the shared meter
+ * @return - none
+ */
+void meter_pipe(int in_fd, int out_fd, struct pipe_meter *meter) {
+    struct pollfd wait_fd;
+    double start = now(), time;
+    int fill;
+    ssize_t n;
 
-        if(builtin_command_code == NOT_BUILTIN) {       /* not builtin command */
-            if(cmd->next_command) {
-		close(new_fd[0]);                       /* closing unnecessary files */
-                dup2(new_fd[1], STDOUT_FILENO);
-		close(new_fd[1]);                       /* closing unnecessary files */
-            } 
+    signal(SIGPIPE, SIG_IGN);                           /* the reader may leave early */
+    meter->capacity = fcntl(in_fd, F_GETPIPE_SZ);
+    fcntl(out_fd, F_SETPIPE_SZ, meter->capacity);
 
-            /* perform redirections */
-            redirection(cmd);
+    while(1) {
+        /* wait for the writing command */
+        wait_fd.fd = in_fd;
+        wait_fd.events = POLLIN;
+        time = now();
+        if(poll(&wait_fd, 1, -1) < 0 && errno == EINTR) {
+            continue;
+        }
+        meter->writer_wait += now() - time;
 
-            execvp(cmd->args[0], cmd->args);
-            /* execvp error */
-            error_message(ERR_CMD_NOTFOUND);
-            exit(EXIT_FAILURE);
-        } else {                                        /* builtin command */
-	    if(cmd->next_command) {
-                close(new_fd[0]);                       /* closing unnecessary files */
-                close(new_fd[1]);                       /* closing unnecessary files */
-	    }
-            exit(status);
+        /* sample how much is queued in the pipe */
+        if(ioctl(in_fd, FIONREAD, &fill) == 0) {
+            meter->fill_sum += fill;
+            meter->samples++;
+            if(fill > meter->fill_max) {
+                meter->fill_max = fill;
+            }
         }
-    } else if(pid > 0) {
-        /* parent */
-        close(fd[0]);                                   /* closing unnecessary files */
-        if(cmd->next_command) {
-	    close(new_fd[1]);                           /* closing unnecessary files */ 
-            pipeline(cmd->next_command, new_fd, job_list);
+
+        n = splice(in_fd, NULL, out_fd, NULL, INT_MAX, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if(n == 0) {                                    /* end of file */
+            break;
+        } else if(n > 0) {
+            meter->bytes += n;
+        } else if(errno == EAGAIN) {                    /* wait for the reading command */
+            wait_fd.fd = out_fd;
+            wait_fd.events = POLLOUT;
+            time = now();
+            poll(&wait_fd, 1, -1);
+            meter->reader_wait += now() - time;
+        } else if(errno != EINTR) {                     /* the reading command left */
+            break;
         }
     }
+    meter->elapsed = now() - start;
+    close(in_fd);
+    close(out_fd);
 }
 
 /*
- * This function frees the memory allocated for the job struct
- * @param - {job *} - the job struct
+ * This function prints out the throughput table of the pipes of a metered job
+ * @param - {sshell_job *} - the job
  * @return - none
  */
-void free_job(struct job *job) {
-    struct command *node;
-    struct command *head = job->first_command;  /* initializes the head of the job list */
+void meter_message(struct sshell_job *job) {
+    struct pipe_meter *meter;
+    int i;
 
-    while(head != NULL) {
-        node = head;                            /* get the current node at the top of the job list */
-        head = head->next_command;              /* iterate to next node of the job list */
-        free_command(node);                     /* free the command */
-        free(node);                             /* free the node */
+    fprintf(stderr, "  pipe        bytes      MB/s  writer-wait  reader-wait  fill-avg  fill-max  slow side\n");
+    for(i = 0; i < job->num_processes - 1; i++) {
+        meter = &(job_state(job)->meters[i]);
+        if(meter->pid > 0) {                            /* the meter has written everything once it exits */
+            waitpid(meter->pid, NULL, 0);
+        }
+        fprintf(stderr, "  %2d -> %-2d %11lld %9.1f %11.3fs %11.3fs %8.0f%% %8.0f%%  %s\n",
+            i + 1, i + 2, meter->bytes,
+            meter->elapsed > 0 ? meter->bytes / meter->elapsed / 1e6 : 0.0,
+            meter->writer_wait, meter->reader_wait,
+            meter->samples && meter->capacity ? 100.0 * meter->fill_sum / meter->samples / meter->capacity : 0.0,
+            meter->capacity ? 100.0 * meter->fill_max / meter->capacity : 0.0,
+            meter->writer_wait > meter->reader_wait ? "writer" : "reader");
     }
-    free(job);
-    return;
 }
 
 /*
- * This function frees the memory allocated for the arguments in the command line struct
- * @param - {command *} - the command line struct
+ * This function turns the metering of the pipes of new jobs on or off
+ * @param - {shell *} - the shell
+ *        - {sshell_job *} - the job running the builtin
+ *        - {sshell_command *} - the meter command: meter [on|off]
+ * @return - {int} - return success or failure status
+ */
+int builtin_meter(struct shell *shell, struct sshell_job *self, struct sshell_command *cmd) {
+    if(cmd->args[1] == NULL) {
+        printf("meter %s\n", shell->meter ? "on" : "off");
+    } else if(strcmp(cmd->args[1], "on") == 0) {
+        shell->meter = 1;
+    } else if(strcmp(cmd->args[1], "off") == 0) {
+        shell->meter = 0;
+    } else {
+        error_message(SSHELL_ERR_INVALID_CMDLINE);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/*
+ * This function puts the shell in its own process group and takes the terminal when it is interactive
+ * @param - {shell *} - the shell
  * @return - none
  */
-void free_command(struct command *cmd) {
-    int i;
-    /* free args space */
-    for(i = 0; i < (cmd->num_args); i++) {
-       if(cmd->args[i]) { 
-           free(cmd->args[i]);                  /* free the allocated memory for each argument */
-       }
+void init_job_control(struct shell *shell) {
+    shell->interactive = isatty(STDIN_FILENO);
+    shell->pgid = getpgrp();
+    if(!shell->interactive) {
+        return;
     }
 
-    /* free input file space */
-    for(i = 0; i < (cmd->num_input); i++) {
-       if(cmd->input_file[i]) {
-           free(cmd->input_file[i]);            /* free the allocated memory for each file */
-       }
+    /* wait until the shell runs in the foreground */
+    while(tcgetpgrp(STDIN_FILENO) != (shell->pgid = getpgrp())) {
+        kill(-shell->pgid, SIGTTIN);
     }
 
-    /* free output file space */
-    for(i = 0; i < (cmd->num_output); i++) {
-       if(cmd->output_file[i]) {
-           free(cmd->output_file[i]);           /* free the allocated memory for each file */
-       }
+    /* the terminal signals are for the foreground job only */
+    signal(SIGINT, SIG_IGN);
+    signal(SIGQUIT, SIG_IGN);
+    signal(SIGTSTP, SIG_IGN);
+    signal(SIGTTIN, SIG_IGN);
+    signal(SIGTTOU, SIG_IGN);
+
+    setpgid(0, 0);
+    shell->pgid = getpgrp();
+    tcsetpgrp(STDIN_FILENO, shell->pgid);
+}
+
+/*
+ * This function puts the child in the process group of its job and restores the signals.
+ *  Without a terminal the child stays in the group of the shell, and a background child
+ *  ignores ctrl-c and ctrl-\ meant for the foreground, as in other shells
+ * @param - {shell *} - the shell
+ *        - {sshell_job *} - the job of the child, no process group yet for the first child
+ *        - {int} - one if the job runs in the foreground
+ * @return - none
+ */
+void child_setup(struct shell *shell, struct sshell_job *job, int foreground) {
+    if(job->grouped) {
+        setpgid(0, job->pgid);
     }
-    return;
+    if(shell->interactive && foreground) {
+        tcsetpgrp(STDIN_FILENO, getpgrp());
+    }
+
+    signal(SIGINT, job->grouped || foreground ? SIG_DFL : SIG_IGN);
+    signal(SIGQUIT, job->grouped || foreground ? SIG_DFL : SIG_IGN);
+    signal(SIGTSTP, SIG_DFL);
+    signal(SIGTTIN, SIG_DFL);
+    signal(SIGTTOU, SIG_DFL);
+    sigprocmask(SIG_SETMASK, &shell->signal_mask, NULL);
 }
 
 /*
- * This function checks if the command line is empty store
- * @param - {char *} - the command line
- * @return - {int} - one for empty, zero for not empty
+ * This function creates the epoll set the shell waits on: the timers of the jobs and
+ *  a signalfd for SIGCHLD, which is blocked in the shell so the signalfd gets it
+ * @param - {shell *} - the shell
+ * @return - none
  */
-int is_empty_command(char *cmd) {
-    int num_white_space;
-    for(num_white_space = 0; cmd[num_white_space] == ' '; num_white_space++);
-    return cmd[num_white_space] == 0 ? 1 : 0;
+void init_events(struct shell *shell) {
+    struct epoll_event event;
+    sigset_t mask;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, &shell->signal_mask);     /* the children get the old mask back */
+
+    shell->events_fd = epoll_create1(EPOLL_CLOEXEC);
+    shell->signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;                                  /* the timers point to their job */
+    epoll_ctl(shell->events_fd, EPOLL_CTL_ADD, shell->signal_fd, &event);
 }
 
 /*
- * This function check if the command line is valid
- * @param - {command *} - the command struct
+ * This function reads a duration: a number of seconds with an optional s, m, h or d suffix
+ * @param - {const char *} - the duration
+ *        - {double *} - the number of seconds
  * @return - {int} - error code
  */
-int is_valid_command(struct command *cmd) {
-    if(cmd == NULL || cmd->command[0] == '<' || cmd->command[0] == 0 ||
-        cmd->command[0] == '>' || cmd->command[0] == '|' || cmd->command[0] == '&') {
-        return ERR_INVALID_CMDLINE;
+int parse_duration(const char *word, double *seconds) {
+    char *end;
+
+    if(word == NULL) {
+        return ERR_INVALID_DURATION;
+    }
+    *seconds = strtod(word, &end);
+    if(end == word || *seconds < 0) {
+        return ERR_INVALID_DURATION;
     }
-    return SUCCESS;
+    switch(*end) {
+        case 'd': *seconds *= 24;                   /* falls through */
+        case 'h': *seconds *= 60;                   /* falls through */
+        case 'm': *seconds *= 60;                   /* falls through */
+        case 's': end++;                            /* falls through */
+        case 0: break;
+        default: return ERR_INVALID_DURATION;
+    }
+    return *end == 0 ? SSHELL_SUCCESS : ERR_INVALID_DURATION;
 }
 
 /*
- * This function checks if the input/output file can be opened and if it is given
- * @param - {char *} - the name of the file
- *        - {int} - check for input or output
- * @return - error code
+ * This function takes the timeout prefix off the job: timeout [-k GRACE] DURATION cmd...
+ * @param - {sshell_job *} - the job
+ * @return - {int} - error code
  */
-int check_redirection_file(char *file, int mode) {
-    int fd;
+int read_timeout(struct sshell_job *job) {
+    struct sshell_command *cmd = job->first_command;
+    double timeout, grace = KILL_GRACE;
+    int i = 1, j, error_code;
 
-    /* file is not given */
-    if(file == NULL) {
-        return (mode == INPUT) ? ERR_NO_INPUTFILE : ERR_NO_OUTPUTFILE;
+    if(strcmp(cmd->args[0], "timeout") != 0) {
+        return SSHELL_SUCCESS;
     }
-
-    /* check input files */
-    if(mode == INPUT) {
-        /* check if the file can be opened */
-        fd = open(file, O_RDONLY);
-        if(fd < 0) {                                        /* error opening file for reading */
-            return ERR_OPEN_INPUTFILE;
-        }
-        close(fd);
-    } else {
-        /* file exists but file doesn't allow access */
-        fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
-        if(fd < 0) {
-            return ERR_OPEN_OUTPUTFILE;                     /* error opening file for writing */
+    if(cmd->args[i] && strcmp(cmd->args[i], "-k") == 0) {
+        error_code = parse_duration(cmd->args[i + 1], &grace);
+        if(error_code != SSHELL_SUCCESS) {
+            return error_code;
         }
-        close(fd);
+        i += 2;
+    }
+    if(cmd->args[i] == NULL || cmd->args[i][0] == '-' || cmd->args[i + 1] == NULL) {
+        return i == 1 ? SSHELL_SUCCESS : SSHELL_ERR_INVALID_CMDLINE; /* the timeout builtin itself */
+    }
+    error_code = parse_duration(cmd->args[i++], &timeout);
+    if(error_code != SSHELL_SUCCESS) {
+        return error_code;
     }
-    return SUCCESS;
+
+    /* the command starts after the duration */
+    for(j = 0; j < i; j++) {
+        sshell_release(job, cmd->args[j]);
+    }
+    cmd->num_args -= i;
+    memmove(cmd->args, cmd->args + i, (cmd->num_args + 1) * sizeof(char *));
+    job_state(job)->timeout = timeout;
+    job_state(job)->grace = grace;
+    return SSHELL_SUCCESS;
 }
 
 /*
- * This function check if the command has redirection file errors or 
- *  mislocated input or output or background sign
- * @param - {command *} - the command struct
- *        - {int} - number of total process
- *        - {int} - the index of the command in the job list
- * @return - {int} - error code
+ * This function arms the timer of the job, creating it in the epoll set of the shell the first time
+ * @param - {shell *} - the shell
+ *        - {sshell_job *} - the job
+ *        - {double} - seconds until the timer expires
+ * @return - {int} - zero on success, -1 on error
  */
-int check_command(struct command *cmd, int num_processes, int index) {
-    int i;
-    int input_index = 0, output_index = 0;
-    int error_code;
+int arm_timer(struct shell *shell, struct sshell_job *job, double seconds) {
+    struct itimerspec value;
+    struct epoll_event event;
+    struct job_state *state = job_state(job);
 
-    for(i = 0; i < strlen(cmd->command); i++) {
-        if(cmd->command[i] == '<') {                        /* check for input file errors */
-            if(index != 0) {                                /* check for input mislocation */
-                return ERR_INPUT_MISLOCATED;
-            }
-            /* check input redirection */
-            error_code = check_redirection_file(
-                cmd->input_file[input_index++], INPUT);
-            if(error_code != SUCCESS) {                         
-                return error_code;
-            }
-        } else if(cmd->command[i] == '>') {                 /* check for output file errors */
-            /* check output redirection */
-            error_code = check_redirection_file(
-                cmd->output_file[output_index++], OUTPUT);
-            if(error_code != SUCCESS) {
-                return error_code;
-            }
-        } else if(cmd->command[i] == '&') {                 /* check for background error */
-            if(index != num_processes - 1 || 
-                i != strlen(cmd->command) - 1) {   
-                /* the background can only be the end of the last command */
-                return ERR_BACKGROUND_MISLOCATED;
-            }
+    if(state->timer_fd < 0) {
+        state->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if(state->timer_fd < 0) {
+            return -1;
         }
+        event.events = EPOLLIN;
+        event.data.ptr = job;
+        epoll_ctl(shell->events_fd, EPOLL_CTL_ADD, state->timer_fd, &event);
     }
-    if(output_index > 0 && index != num_processes - 1) {    /* check for output mislocation */
-        return ERR_OUTPUT_MISLOCATED;
+
+    memset(&value, 0, sizeof(value));                   /* one shot */
+    value.it_value.tv_sec = (time_t) seconds;
+    value.it_value.tv_nsec = (long) ((seconds - value.it_value.tv_sec) * 1e9);
+    if(value.it_value.tv_sec == 0 && value.it_value.tv_nsec == 0) {
+        value.it_value.tv_nsec = 1;                     /* zero would disarm it */
     }
-    return SUCCESS;
+    return timerfd_settime(state->timer_fd, 0, &value, NULL);
 }
 
 /*
- * This function check if the job has any error before executing
- * @param - {job *} - the job struct
- * @return - {int} - error code
+ * This function disarms and closes the timer of the job
+ * @param - {sshell_job *} - the job
+ * @return - none
  */
-int check_job(struct job *job) {
-    struct command *cmd = job->first_command;
-    int i, error_code;
+void disarm_timer(struct sshell_job *job) {
+    struct itimerspec value;
+    struct job_state *state = job_state(job);
 
-    for(i = 0; i < job->num_processes; i++) {
-        /* check valid command error */
-        error_code = is_valid_command(cmd);
-        if(error_code != SUCCESS)
-            return error_code;
-        
-        /* check mislocated and redirection errors */
-        error_code = check_command(cmd, job->num_processes, i);
-        if(error_code != SUCCESS)
-            return error_code;
-        
-        /* get next command */
-        cmd = cmd->next_command;
+    if(state->timer_fd < 0) {
+        return;
     }
-    return SUCCESS;
+    /* a child without exec may still hold the timer: it must never fire for a freed job */
+    memset(&value, 0, sizeof(value));
+    timerfd_settime(state->timer_fd, 0, &value, NULL);
+    close(state->timer_fd);                             /* closing leaves the epoll set */
+    state->timer_fd = -1;
 }
 
 /*
- * This function check if the command line is a builtin command
- * @param - {command *} - the command line struct
- * @return - {int} - builtin command enum
+ * This function handles the expired timer of the job: SIGTERM first, SIGKILL after the grace period
+ * @param - {shell *} - the shell
+ *        - {sshell_job *} - the job
+ * @return - none
  */
-int is_builtin_command(const struct command *cmd) {
-    if(strcmp(cmd->args[0], "exit") == 0) {         /* exit */
-        return EXIT;
-    } else if(strcmp(cmd->args[0], "cd") == 0) {    /* cd */
-        return CD;
-    } else if(strcmp(cmd->args[0], "pwd") == 0) {   /* pwd */
-        return PWD;
+void expire_job(struct shell *shell, struct sshell_job *job) {
+    uint64_t expirations;
+    struct job_state *state = job_state(job);
+
+    read(state->timer_fd, &expirations, sizeof(expirations));
+    if(job->finish == SSHELL_FINISHED || job->pgid == 0) {  /* every process was reaped */
+        return;
+    }
+
+    if(state->timed_out == 0 && state->grace > 0) {
+        state->timed_out = 1;
+        sshell_signal(job, SIGTERM);
+        sshell_signal(job, SIGCONT);                    /* a stopped job gets it when it continues */
+        arm_timer(shell, job, state->grace);
     } else {
-        return NOT_BUILTIN;                         /* not a built in command */
+        state->timed_out = 2;
+        sshell_signal(job, SIGKILL);
     }
 }
 
 /*
- * This function changes the working directory specfied by the parameter
- * @param - {const char *} - the directory name
- * @return - {int} - return success or failure status 
+ * This function checks if a job of the job list has a timer
+ * @param - {job_list *} - the job list
+ * @return - {int} - one if a timer may still expire
  */
-int cd(const char *dir) {
-   int status = chdir(dir);
-   if(status == -1) {
-       error_message(ERR_DIR_NOTFOUND);
-       return EXIT_FAILURE;
-   } 
-   return EXIT_SUCCESS;
+int timers_armed(struct job_list *job_list) {
+    struct sshell_job *job;
+    for(job = job_list->first_job; job; job = job->next_job) {
+        if(job_state(job)->timer_fd >= 0 && job->finish != SSHELL_FINISHED) {
+            return 1;
+        }
+    }
+    return 0;
 }
 
 /*
- * This function prints out the working directory
- * @param - none
- * @return - {int} - return success or failure status
+ * This function checks if a job of the job list is still running, not stopped
+ * @param - {job_list *} - the job list
+ * @return - {int} - one if a job may still finish
  */
-int pwd() {
-    char cwd[MAX_CMD];
-    getcwd(cwd, MAX_CMD);
-    if(cwd != NULL) {       /* success */
-        printf("%s\n", cwd);
-        return EXIT_SUCCESS;
-    } else {                /* failure */
-        return EXIT_FAILURE;    
+int jobs_running(struct job_list *job_list) {
+    struct sshell_job *job;
+    for(job = job_list->first_job; job; job = job->next_job) {
+        if(job->finish != SSHELL_FINISHED && !job->stopped) {
+            return 1;
+        }
     }
+    return 0;
 }
 
 /*
- * This function handles the input/output redirection and connects according std
- * @param - {command *} - the command struct that contains the files info
- * @return - none
+ * This function checks if the shell waits for an event: a timer of a job or of the deferred
+ *  jobs, or the output of a job to keep in its ring
+ * @param - {shell *} - the shell
+ * @return - {int} - one if an event may still come
  */
-void redirection(const struct command *cmd) {
-    int fd, i;
-
-    /* input redirection */
-    for(i = 0; i < cmd->num_input; i++) {           
-        fd = open(cmd->input_file[i], O_RDONLY);
-        dup2(fd, STDIN_FILENO);
-        close(fd);               /* close unused file */
-    }
-
-    /* output redirection */
-    for(i = 0; i < cmd->num_output; i++) {  
-        fd = open(cmd->output_file[i], 
-            O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR); /* create the file if not exist */
-        dup2(fd, STDOUT_FILENO);
-        close(fd);               /* close unused file */
-    }
-    return;
+int events_pending(struct shell *shell) {
+    return timers_armed(shell->job_list) || shell->throttle.first_deferred || shell->output.num_open > 0;
 }
 
 /*
- * This function checks the background processes and adds completed status if completed 
- * @param - {job *} - the start of the job list
- *    - {job *} - the end of the background processes
- * @return - none
+ * This function waits for the events of the shell, handling the expired timers, until a child
+ *  changes state, the file descriptor is readable or the time is out
+ * @param - {shell *} - the shell
+ *        - {int} - the file descriptor to wait for, -1 for none
+ *        - {int} - milliseconds to wait, -1 to wait as long as needed
+ * @return - {int} - one if the file descriptor is readable
  */
-void check_background_process(struct job *job_start, struct job *job_end) {
-    pid_t pid;
-    int i, status;
-    struct command *cmd;
-    struct job *job = job_start;
+int wait_events(struct shell *shell, int fd, int timeout) {
+    struct epoll_event events[MAX_EVENTS];
+    struct signalfd_siginfo info;
+    uint64_t expirations;
+    struct pollfd wait_fds[2];
+    int i, n;
 
-    /* check background processes */
-    while(job != job_end) {
-        cmd = job->first_command;
-        /* check each sub processes */
-        for(i = 0; i < job->num_processes; i++) {
-            pid = waitpid(cmd->pid, &status, WNOHANG);      /* check if that subprocess has completed */
-            if(pid != NOT_FINISHED) {                       /* a process has finished */
-                insert_status(job_start, pid, status);
+    wait_fds[0].fd = shell->events_fd;
+    wait_fds[0].events = POLLIN;
+    wait_fds[1].fd = fd;                                /* poll skips a negative descriptor */
+    wait_fds[1].events = POLLIN;
+    wait_fds[1].revents = 0;
+    if(poll(wait_fds, 2, timeout) <= 0) {
+        return 0;
+    }
+
+    if(wait_fds[0].revents & POLLIN) {
+        n = epoll_wait(shell->events_fd, events, MAX_EVENTS, 0);
+        for(i = 0; i < n; i++) {
+            if(events[i].data.ptr == NULL) {            /* children changed state: the caller reaps them */
+                while(read(shell->signal_fd, &info, sizeof(info)) > 0);
+            } else if(events[i].data.ptr == &shell->throttle) {    /* run_deferred() launches the jobs */
+                read(shell->throttle.timer_fd, &expirations, sizeof(expirations));
+                shell->throttle.due = 1;
+            } else if(events[i].data.ptr == &shell->output) {  /* background jobs wrote */
+                drain_rings(shell);
+            } else {
+                expire_job(shell, (struct sshell_job *) events[i].data.ptr);
             }
-            cmd = cmd->next_command;
         }
-        job->finish = check_finish_job(job);
-        job = job->next_job;
     }
+    return (wait_fds[1].revents & (POLLIN | POLLHUP)) != 0;
 }
 
 /*
- * This function prints out according error mesage depending on error code
- * @param - {int} - error code enum
+ * This function prints out or sets the timeout of the background jobs started without one
+ * @param - {shell *} - the shell
+ *        - {sshell_job *} - the job running the builtin
+ *        - {sshell_command *} - the timeout command: timeout [-b DURATION]
+ * @return - {int} - return success or failure status
+ */
+int builtin_timeout(struct shell *shell, struct sshell_job *self, struct sshell_command *cmd) {
+    double seconds;
+    int error_code;
+
+    if(cmd->args[1] == NULL) {
+        if(shell->background_timeout > 0) {
+            printf("timeout -b %gs\n", shell->background_timeout);
+        } else {
+            printf("timeout -b 0\n");
+        }
+        return EXIT_SUCCESS;
+    }
+    if(strcmp(cmd->args[1], "-b") != 0 || cmd->num_args != 3) {
+        error_message(SSHELL_ERR_INVALID_CMDLINE);
+        return EXIT_FAILURE;
+    }
+    error_code = parse_duration(cmd->args[2], &seconds);
+    if(error_code != SSHELL_SUCCESS) {
+        error_message(error_code);
+        return EXIT_FAILURE;
+    }
+    shell->background_timeout = seconds;
+    return EXIT_SUCCESS;
+}
+
+/*
+ * This function gives the terminal to the job and waits until it finishes or stops
+ * @param - {shell *} - the shell
+ *        - {sshell_job *} - the job
+ * @return - none
+ */
+void wait_foreground(struct shell *shell, struct sshell_job *job) {
+    pid_t pid;
+    int status;
+    int timers = events_pending(shell);                 /* then wait in the event loop, not in waitpid */
+
+    if(job->finish == SSHELL_FINISHED) {                /* builtin commands ran in the shell */
+        return;
+    }
+    if(shell->interactive) {
+        tcsetpgrp(STDIN_FILENO, job->pgid);
+    }
+
+    /* wait for the processes of the job */
+    while(job->finish != SSHELL_FINISHED) {
+        pid = sshell_waitpid(job, &status, WUNTRACED | (timers ? WNOHANG : 0));
+        if(pid < 0) {                                   /* no process left in the group */
+            break;
+        }
+        if(pid == 0) {                                  /* wait for SIGCHLD or a timer */
+            wait_events(shell, -1, -1);
+            continue;
+        }
+        if(WIFSTOPPED(status)) {                        /* ctrl-z: the job goes to the job list */
+            job->stopped = 1;
+            sshell_last_command(job)->background = 1;
+            shell->job_list->current = job;
+            fprintf(stderr, "[%d] stopped '%s'\n", job_state(job)->id, job->commandline);
+            break;
+        }
+        insert_status(shell->job_list->first_job, pid, status);
+        job->finish = sshell_check_finish(job);
+    }
+
+    if(shell->interactive) {
+        tcsetpgrp(STDIN_FILENO, shell->pgid);
+    }
+}
+
+/*
+ * This function waits until the job finishes
+ * @param - {shell *} - the shell
+ *        - {sshell_job *} - the job
+ * @return - {int} - exit status of the last command of the job
+ */
+int wait_job(struct shell *shell, struct sshell_job *job) {
+    pid_t pid;
+    int status;
+    int timers = events_pending(shell);
+
+    while(job->finish != SSHELL_FINISHED && !job->stopped) {
+        pid = sshell_waitpid(job, &status, timers ? WNOHANG : 0);
+        if(pid < 0) {
+            break;
+        }
+        if(pid == 0) {
+            wait_events(shell, -1, -1);
+            continue;
+        }
+        insert_status(shell->job_list->first_job, pid, status);
+        job->finish = sshell_check_finish(job);
+    }
+    if(job->finish != SSHELL_FINISHED) {
+        return EXIT_FAILURE;
+    }
+    return sshell_exit_status(sshell_last_command(job)->status);
+}
+
+/*
+ * This function runs the builtin command in the shell with its redirections, without fork or exec
+ * @param - {shell *} - the shell
+ *        - {sshell_job *} - the job of the builtin command
+ *        - {sshell_command *} - the builtin command
+ *        - {const builtin *} - the builtin
+ * @return - {int} - return success or failure status
+ */
+int run_in_shell(struct shell *shell, struct sshell_job *job, struct sshell_command *cmd, const struct builtin *builtin) {
+    int saved_in = -1, saved_out = -1;
+    int status, error_code = SSHELL_SUCCESS;
+    pid_t relay = -1;
+
+    /* redirect the shell and keep its own streams */
+    if(cmd->num_input || cmd->num_output) {
+        fflush(stdout);
+        saved_in = dup(STDIN_FILENO);
+        saved_out = dup(STDOUT_FILENO);
+        error_code = sshell_redirect(cmd);
+        if(error_code == SSHELL_SUCCESS && cmd->num_output > 1) {
+            relay = sshell_start_relay(cmd, &error_code);
+        }
+    }
+
+    if(error_code == SSHELL_SUCCESS) {
+        status = builtin->run(shell, job, cmd);
+    } else {
+        error_message(error_code);
+        status = EXIT_FAILURE;
+    }
+    fflush(stdout);                                 /* the output comes before the completion message */
+
+    /* restore the streams of the shell */
+    if(saved_in >= 0) {
+        dup2(saved_in, STDIN_FILENO);
+        dup2(saved_out, STDOUT_FILENO);
+        close(saved_in);
+        close(saved_out);
+    }
+    if(relay > 0) {                                 /* the relay gets end of file from the restore */
+        waitpid(relay, NULL, 0);
+    }
+
+    cmd->pid = 0;                                   /* no process to wait for */
+    cmd->status = W_EXITCODE(status, 0);
+    cmd->finish = SSHELL_FINISHED;
+    return status;
+}
+
+/*
+ * This function prints out the jobs in the job list
+ * @param - {shell *} - the shell
+ *        - {sshell_job *} - the job running the builtin, not printed
+ *        - {sshell_command *} - the jobs command
+ * @return - {int} - return success status
+ */
+int builtin_jobs(struct shell *shell, struct sshell_job *self, struct sshell_command *cmd) {
+    struct sshell_job *job;
+    for(job = shell->job_list->first_job; job; job = job->next_job) {
+        if(job != self && job_state(job)->id) {
+            printf("[%d] %s '%s'\n", job_state(job)->id, job->stopped ? "Stopped" : "Running", job->commandline);
+        }
+    }
+    for(job = shell->throttle.first_deferred; job; job = job->next_job) {
+        printf("[%d] Deferred '%s'\n", job_state(job)->id, job->commandline);
+    }
+    return EXIT_SUCCESS;
+}
+
+/*
+ * This function continues the job in the foreground and waits for it, a deferred job starts
+ * @param - {shell *} - the shell
+ *        - {sshell_job *} - the job running the builtin
+ *        - {sshell_command *} - the fg command: fg [%n]
+ * @return - {int} - exit status of the job
+ */
+int builtin_fg(struct shell *shell, struct sshell_job *self, struct sshell_command *cmd) {
+    struct sshell_job *job = find_job(shell->job_list, cmd->args[1], self);
+
+    if(job == NULL) {
+        error_message(ERR_NO_SUCH_JOB);
+        return EXIT_FAILURE;
+    }
+    if(job_state(job)->deferred == 1) {                 /* start it now, whatever the pressure */
+        return start_deferred(shell, job, 1);
+    }
+
+    sshell_last_command(job)->background = 0;
+    job->stopped = 0;
+    if(shell->interactive) {
+        tcsetpgrp(STDIN_FILENO, job->pgid);     /* give the terminal before continuing */
+    }
+    sshell_signal(job, SIGCONT);
+    wait_foreground(shell, job);
+    if(job->finish != SSHELL_FINISHED) {
+        return EXIT_FAILURE;
+    }
+    return sshell_exit_status(sshell_last_command(job)->status);
+}
+
+/*
+ * This function continues the stopped job in the background, a deferred job starts
+ * @param - {shell *} - the shell
+ *        - {sshell_job *} - the job running the builtin
+ *        - {sshell_command *} - the bg command: bg [%n]
+ * @return - {int} - return success or failure status
+ */
+int builtin_bg(struct shell *shell, struct sshell_job *self, struct sshell_command *cmd) {
+    struct sshell_job *job = find_job(shell->job_list, cmd->args[1], self);
+
+    if(job == NULL) {
+        error_message(ERR_NO_SUCH_JOB);
+        return EXIT_FAILURE;
+    }
+    if(job_state(job)->deferred == 1) {
+        return start_deferred(shell, job, 0);
+    }
+
+    job->stopped = 0;
+    shell->job_list->current = job;
+    sshell_signal(job, SIGCONT);
+    return EXIT_SUCCESS;
+}
+
+/*
+ * This function sends a signal to the process group of each %n job or to each pid, a
+ *  deferred job is cancelled
+ * @param - {shell *} - the shell
+ *        - {sshell_job *} - the job running the builtin
+ *        - {sshell_command *} - the kill command: kill [-SIGNAL] %n|pid...
+ * @return - {int} - return success or failure status
+ */
+int builtin_kill(struct shell *shell, struct sshell_job *self, struct sshell_command *cmd) {
+    static const struct {
+        const char *name;
+        int number;
+    } signals[] = {
+        {"HUP", SIGHUP}, {"INT", SIGINT}, {"QUIT", SIGQUIT}, {"KILL", SIGKILL},
+        {"USR1", SIGUSR1}, {"USR2", SIGUSR2}, {"TERM", SIGTERM}, {"CONT", SIGCONT},
+        {"STOP", SIGSTOP}, {"TSTP", SIGTSTP}, {NULL, 0}
+    };
+    int i = 1, j, sig = SIGTERM, status = EXIT_SUCCESS;
+    const char *name;
+    struct sshell_job *job;
+
+    /* get the signal */
+    if(cmd->args[1] && cmd->args[1][0] == '-') {
+        name = cmd->args[1] + 1;
+        if(strncmp(name, "SIG", 3) == 0) {
+            name += 3;
+        }
+        if(isdigit(name[0])) {
+            sig = atoi(name);
+        } else {
+            for(j = 0; signals[j].name && strcmp(signals[j].name, name) != 0; j++);
+            sig = signals[j].number;
+        }
+        if(sig <= 0 || sig >= NSIG) {
+            error_message(ERR_INVALID_SIGNAL);
+            return EXIT_FAILURE;
+        }
+        i++;
+    }
+
+    for(; i < cmd->num_args; i++) {
+        if(cmd->args[i][0] == '%') {                    /* signal the process group of the job */
+            job = find_job(shell->job_list, cmd->args[i], self);
+            if(job == NULL) {
+                error_message(ERR_NO_SUCH_JOB);
+                status = EXIT_FAILURE;
+                continue;
+            }
+            if(job_state(job)->deferred == 1) {         /* it never started: cancel it */
+                if(sig != SIGCONT && sig != SIGSTOP && sig != SIGTSTP) {
+                    dequeue_job(&shell->throttle, job);
+                    fprintf(stderr, "+ cancelled '%s'\n", job->commandline);
+                    remove_job_id(shell->job_list, job);
+                    free_job(job);
+                }
+                continue;
+            }
+            sshell_signal(job, sig);
+            if(job->stopped && sig != SIGSTOP && sig != SIGTSTP && sig != SIGCONT) {
+                sshell_signal(job, SIGCONT);            /* a stopped job gets the signal when it continues */
+            }
+        } else if(kill(atoi(cmd->args[i]), sig) < 0) {  /* signal the process */
+            perror("kill");
+            status = EXIT_FAILURE;
+        }
+    }
+    return status;
+}
+
+/*
+ * This function waits for the %n jobs, for all jobs, or with -n for the next job to finish
+ * @param - {shell *} - the shell
+ *        - {sshell_job *} - the job running the builtin
+ *        - {sshell_command *} - the wait command: wait [-n] [%n...]
+ * @return - {int} - exit status of the last job waited for
+ */
+int builtin_wait(struct shell *shell, struct sshell_job *self, struct sshell_command *cmd) {
+    struct sshell_job *targets[MAX_ARGS], *job;
+    int i, j, num_targets = 0, any = 0, status = EXIT_SUCCESS;
+    int timers = events_pending(shell);
+    pid_t pid;
+
+    for(i = 1; i < cmd->num_args; i++) {
+        if(strcmp(cmd->args[i], "-n") == 0) {
+            any = 1;
+        } else if((job = find_job(shell->job_list, cmd->args[i], self))) {
+            targets[num_targets++] = job;
+        } else {
+            error_message(ERR_NO_SUCH_JOB);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if(!any) {
+        /* wait for the given jobs, or for every other job, once they started */
+        for(i = 0; i < num_targets; i++) {
+            wait_deferred(shell, targets[i]);
+        }
+        if(num_targets == 0) {
+            wait_deferred(shell, NULL);
+            for(job = shell->job_list->first_job; job; job = job->next_job) {
+                if(job != self) {
+                    status = wait_job(shell, job);
+                }
+            }
+        }
+        for(i = 0; i < num_targets; i++) {
+            status = wait_job(shell, targets[i]);
+        }
+        return status;
+    }
+
+    /* wait for the next job to finish */
+    while((pid = waitpid(-1, &status, timers ? WNOHANG : 0)) >= 0) {
+        if(pid == 0) {
+            wait_events(shell, -1, -1);
+            continue;
+        }
+        job = insert_status(shell->job_list->first_job, pid, status);
+        if(job == NULL || job == self) {
+            continue;
+        }
+        job->finish = sshell_check_finish(job);
+        if(job->finish != SSHELL_FINISHED) {
+            continue;
+        }
+        for(j = 0; j < num_targets && targets[j] != job; j++);
+        if(num_targets == 0 || j < num_targets) {
+            return sshell_exit_status(sshell_last_command(job)->status);
+        }
+    }
+    return 127;
+}
+
+/*
+ * This function frees the memory allocated for the job struct
+ * @param - {sshell_job *} - the job struct
+ * @return - none
+ */
+void free_job(struct sshell_job *job) {
+    struct job_state *state = job_state(job);
+
+    if(state->meters) {
+        munmap(state->meters, (job->num_processes - 1) * sizeof(struct pipe_meter));
+    }
+    disarm_timer(job);
+    if(state->cwd_fd >= 0) {
+        close(state->cwd_fd);
+    }
+    if(state->capture) {                        /* the result was never stored */
+        unlink(state->capture);
+        free(state->capture);
+    }
+    if(state->output) {                         /* the tail goes with the job */
+        close_ring(state);
+        state->output->used -= state->ring.capacity;
+        free(state->ring.data);
+    }
+    free(state);
+    sshell_free_job(job);                       /* free the commands and the job */
+    return;
+}
+
+/*
+ * This function checks if the command line is empty store
+ * @param - {char *} - the command line
+ * @return - {int} - one for empty, zero for not empty
+ */
+int is_empty_command(char *cmd) {
+    int num_white_space;
+    for(num_white_space = 0; cmd[num_white_space] == ' '; num_white_space++);
+    return cmd[num_white_space] == 0 ? 1 : 0;
+}
+
+/*
+ * This function hashes the name of a builtin command
+ * @param - {const char *} - the name
+ * @return - {unsigned int} - the hash
+ */
+unsigned int hash_name(const char *name) {
+    unsigned int hash = 5381;
+    for(; *name; name++) {
+        hash = hash * 33 + (unsigned char) *name;
+    }
+    return hash;
+}
+
+/*
+ * This function adds (or replaces) a builtin command in the hash table of the shell
+ * @param - {shell *} - the shell
+ *        - {const char *} - the name of the command
+ *        - {function pointer} - the function running the command
+ *        - {int} - builtin command flag
+ * @return - none
+ */
+void register_builtin(struct shell *shell, const char *name,
+    int (*run)(struct shell *, struct sshell_job *, struct sshell_command *), int flag) {
+    struct builtin **bucket = &(shell->builtins[hash_name(name) % BUILTIN_BUCKETS]);
+    struct builtin *builtin = (struct builtin*) find_builtin(shell, name);
+
+    if(builtin == NULL) {
+        builtin = (struct builtin*) malloc(sizeof(struct builtin));
+        builtin->name = name;
+        builtin->next_builtin = *bucket;
+        *bucket = builtin;
+    }
+    builtin->run = run;
+    builtin->flag = flag;
+}
+
+/*
+ * This function registers the builtin commands of the shell
+ * @param - {shell *} - the shell
+ * @return - none
+ */
+void init_builtins(struct shell *shell) {
+    memset(shell->builtins, 0, sizeof(shell->builtins));
+
+    /* commands changing the shell */
+    register_builtin(shell, "exit", builtin_exit, BUILTIN_SHELL);
+    register_builtin(shell, "cd", builtin_cd, BUILTIN_SHELL);
+    register_builtin(shell, "jobs", builtin_jobs, BUILTIN_SHELL);
+    register_builtin(shell, "fg", builtin_fg, BUILTIN_SHELL);
+    register_builtin(shell, "bg", builtin_bg, BUILTIN_SHELL);
+    register_builtin(shell, "kill", builtin_kill, BUILTIN_SHELL);
+    register_builtin(shell, "wait", builtin_wait, BUILTIN_SHELL);
+    register_builtin(shell, "meter", builtin_meter, BUILTIN_SHELL);
+    register_builtin(shell, "timeout", builtin_timeout, BUILTIN_SHELL);
+    register_builtin(shell, "cache", builtin_cache, BUILTIN_SHELL);
+    register_builtin(shell, "throttle", builtin_throttle, BUILTIN_SHELL);
+    register_builtin(shell, "output", builtin_output, BUILTIN_SHELL);
+
+    /* commands that only need fork in a pipeline or in the background */
+    register_builtin(shell, "pwd", builtin_pwd, BUILTIN_CHILD);
+    register_builtin(shell, "true", builtin_true, BUILTIN_CHILD);
+    register_builtin(shell, "false", builtin_false, BUILTIN_CHILD);
+    register_builtin(shell, "echo", builtin_echo, BUILTIN_CHILD);
+    register_builtin(shell, "printf", builtin_printf, BUILTIN_CHILD);
+    register_builtin(shell, "test", builtin_test, BUILTIN_CHILD);
+    register_builtin(shell, "[", builtin_test, BUILTIN_CHILD);
+}
+
+/*
+ * This function frees the hash table of the builtin commands
+ * @param - {shell *} - the shell
+ * @return - none
+ */
+void free_builtins(struct shell *shell) {
+    struct builtin *builtin;
+    int i;
+
+    for(i = 0; i < BUILTIN_BUCKETS; i++) {
+        while(shell->builtins[i]) {
+            builtin = shell->builtins[i];
+            shell->builtins[i] = builtin->next_builtin;
+            free(builtin);
+        }
+    }
+}
+
+/*
+ * This function finds the builtin command by name
+ * @param - {shell *} - the shell
+ *        - {const char *} - the name of the command
+ * @return - {const builtin *} - the builtin, NULL if not a built in command
+ */
+const struct builtin *find_builtin(struct shell *shell, const char *name) {
+    const struct builtin *builtin = shell->builtins[hash_name(name) % BUILTIN_BUCKETS];
+    while(builtin && strcmp(builtin->name, name) != 0) {
+        builtin = builtin->next_builtin;
+    }
+    return builtin;
+}
+
+/*
+ * This function leaves the shell if there are no active jobs
+ * @param - {shell *} - the shell
+ *        - {sshell_job *} - the job running the builtin
+ *        - {sshell_command *} - the exit command
+ * @return - {int} - return success or failure status
+ */
+int builtin_exit(struct shell *shell, struct sshell_job *self, struct sshell_command *cmd) {
+    if(shell->job_list->first_job != self || self->next_job ||  /* try to exit while there are active jobs */
+        shell->throttle.first_deferred) {
+        error_message(ERR_ACTIVE_JOBS);
+        return EXIT_FAILURE;
+    }
+    fprintf(stderr, "Bye...\n");
+    shell->exiting = 1;
+    return EXIT_SUCCESS;
+}
+
+/*
+ * This function changes the working directory specfied by the parameter
+ * @param - {shell *} - the shell
+ *        - {sshell_job *} - the job running the builtin
+ *        - {sshell_command *} - the cd command: cd dir
+ * @return - {int} - return success or failure status 
+ */
+int builtin_cd(struct shell *shell, struct sshell_job *self, struct sshell_command *cmd) {
+   int status = cmd->args[1] ? chdir(cmd->args[1]) : -1;
+   if(status == -1) {
+       error_message(ERR_DIR_NOTFOUND);
+       return EXIT_FAILURE;
+   } 
+   return EXIT_SUCCESS;
+}
+
+/*
+ * This function prints out the working directory
+ * @param - {shell *} - the shell
+ *        - {sshell_job *} - the job running the builtin
+ *        - {sshell_command *} - the pwd command
+ * @return - {int} - return success or failure status
+ */
+int builtin_pwd(struct shell *shell, struct sshell_job *self, struct sshell_command *cmd) {
+    char cwd[MAX_CMD];
+    if(getcwd(cwd, MAX_CMD) != NULL) {      /* success */
+        printf("%s\n", cwd);
+        return EXIT_SUCCESS;
+    } else {                /* failure */
+        return EXIT_FAILURE;    
+    }
+}
+
+/*
+ * This function does nothing successfully
+ * @param - {shell *} - the shell
+ *        - {sshell_job *} - the job running the builtin
+ *        - {sshell_command *} - the true command
+ * @return - {int} - return success status
+ */
+int builtin_true(struct shell *shell, struct sshell_job *self, struct sshell_command *cmd) {
+    return EXIT_SUCCESS;
+}
+
+/*
+ * This function does nothing unsuccessfully
+ * @param - {shell *} - the shell
+ *        - {sshell_job *} - the job running the builtin
+ *        - {sshell_command *} - the false command
+ * @return - {int} - return failure status
+ */
+int builtin_false(struct shell *shell, struct sshell_job *self, struct sshell_command *cmd) {
+    return EXIT_FAILURE;
+}
+
+/*
+ * This function prints out the arguments separated by spaces
+ * @param - {shell *} - the shell
+ *        - {sshell_job *} - the job running the builtin
+ *        - {sshell_command *} - the echo command: echo [-n] args...
+ * @return - {int} - return success status
+ */
+int builtin_echo(struct shell *shell, struct sshell_job *self, struct sshell_command *cmd) {
+    int i = 1, newline = 1;
+
+    if(cmd->args[1] && strcmp(cmd->args[1], "-n") == 0) {  /* no trailing newline */
+        newline = 0;
+        i++;
+    }
+    for(; i < cmd->num_args; i++) {
+        fputs(cmd->args[i], stdout);
+        if(i < cmd->num_args - 1) {
+            putchar(' ');
+        }
+    }
+    if(newline) {
+        putchar('\n');
+    }
+    return EXIT_SUCCESS;
+}
+
+/*
+ * This function prints out the arguments with the format, the format is reused for extra arguments
+ * @param - {shell *} - the shell
+ *        - {sshell_job *} - the job running the builtin
+ *        - {sshell_command *} - the printf command: printf format args...
+ * @return - {int} - return success or failure status
+ */
+int builtin_printf(struct shell *shell, struct sshell_job *self, struct sshell_command *cmd) {
+    char spec[32];
+    const char *f, *arg;
+    int i = 2, j, used;
+
+    if(cmd->num_args < 2) {
+        return EXIT_FAILURE;
+    }
+
+    do {
+        used = 0;
+        for(f = cmd->args[1]; *f; f++) {
+            if(*f == '\\' && f[1]) {                    /* escape sequence */
+                f++;
+                switch(*f) {
+                    case 'n': putchar('\n'); break;
+                    case 't': putchar('\t'); break;
+                    case '\\': putchar('\\'); break;
+                    default: putchar('\\'); putchar(*f); break;
+                }
+            } else if(*f == '%' && f[1] == '%') {       /* percent sign */
+                putchar('%');
+                f++;
+            } else if(*f == '%') {                      /* conversion: flags, width and precision */
+                for(j = 0; j < sizeof(spec) - 3 && *f && strchr("%-+ #0123456789.", *f); j++) {
+                    spec[j] = *f++;
+                }
+                arg = i < cmd->num_args ? cmd->args[i++] : NULL;
+                used = 1;
+                if(*f == 'd' || *f == 'i' || *f == 'x' || *f == 'X' || *f == 'o' || *f == 'u') {
+                    spec[j++] = 'l';
+                    spec[j++] = *f;
+                    spec[j] = 0;
+                    printf(spec, arg ? strtol(arg, NULL, 0) : 0L);
+                } else if(*f && strchr("fFeEgGaA", *f)) {
+                    spec[j++] = *f;
+                    spec[j] = 0;
+                    printf(spec, arg ? strtod(arg, NULL) : 0.0);
+                } else if(*f == 'c') {
+                    spec[j++] = 'c';
+                    spec[j] = 0;
+                    printf(spec, arg ? arg[0] : 0);
+                } else if(*f == 's') {
+                    spec[j++] = 's';
+                    spec[j] = 0;
+                    printf(spec, arg ? arg : "");
+                } else {                                /* an unknown conversion, or none */
+                    fflush(stdout);
+                    error_message(ERR_INVALID_FORMAT);
+                    return EXIT_FAILURE;
+                }
+            } else {
+                putchar(*f);
+            }
+        }
+    } while(used && i < cmd->num_args);
+    return EXIT_SUCCESS;
+}
+
+/*
+ * This function evaluates a test expression: ! expr, string, unary file/string tests
+ *  and binary string/integer comparisons
+ * @param - {char **} - the arguments of the expression
+ *        - {int} - number of arguments
+ * @return - {int} - zero for true, one for false, two for a bad expression
+ */
+int test_expression(char **args, int num_args) {
+    struct stat info;
+    const char *op;
+    long left, right;
+    int status;
+
+    if(num_args == 0) {
+        return EXIT_FAILURE;
+    }
+    if(strcmp(args[0], "!") == 0 && num_args > 1) {     /* negation */
+        status = test_expression(args + 1, num_args - 1);
+        return status == 2 ? status : !status;
+    }
+
+    if(num_args == 1) {                                 /* non empty string */
+        return args[0][0] == 0;
+    } else if(num_args == 2) {                          /* unary operator */
+        op = args[0];
+        if(strcmp(op, "-z") == 0) {
+            return args[1][0] != 0;
+        } else if(strcmp(op, "-n") == 0) {
+            return args[1][0] == 0;
+        } else if(strcmp(op, "-r") == 0) {
+            return access(args[1], R_OK) != 0;
+        } else if(strcmp(op, "-w") == 0) {
+            return access(args[1], W_OK) != 0;
+        } else if(strcmp(op, "-x") == 0) {
+            return access(args[1], X_OK) != 0;
+        } else if(strlen(op) != 2 || op[0] != '-' || !strchr("efds", op[1])) {
+            return 2;
+        }
+        if(stat(args[1], &info) < 0) {
+            return EXIT_FAILURE;
+        }
+        switch(op[1]) {
+            case 'f': return !S_ISREG(info.st_mode);
+            case 'd': return !S_ISDIR(info.st_mode);
+            case 's': return info.st_size == 0;
+        }
+        return EXIT_SUCCESS;
+    } else if(num_args == 3) {                          /* binary operator */
+        op = args[1];
+        if(strcmp(op, "=") == 0 || strcmp(op, "==") == 0) {
+            return strcmp(args[0], args[2]) != 0;
+        } else if(strcmp(op, "!=") == 0) {
+            return strcmp(args[0], args[2]) == 0;
+        }
+        left = strtol(args[0], NULL, 10);
+        right = strtol(args[2], NULL, 10);
+        if(strcmp(op, "-eq") == 0) {
+            return !(left == right);
+        } else if(strcmp(op, "-ne") == 0) {
+            return !(left != right);
+        } else if(strcmp(op, "-lt") == 0) {
+            return !(left < right);
+        } else if(strcmp(op, "-le") == 0) {
+            return !(left <= right);
+        } else if(strcmp(op, "-gt") == 0) {
+            return !(left > right);
+        } else if(strcmp(op, "-ge") == 0) {
+            return !(left >= right);
+        }
+    }
+    return 2;
+}
+
+/*
+ * This function evaluates the test (or [ ... ]) expression
+ * @param - {shell *} - the shell
+ *        - {sshell_job *} - the job running the builtin
+ *        - {sshell_command *} - the test command: test expr, [ expr ]
+ * @return - {int} - zero for true, one for false, two for a bad expression
+ */
+int builtin_test(struct shell *shell, struct sshell_job *self, struct sshell_command *cmd) {
+    int num_args = cmd->num_args - 1;
+
+    if(strcmp(cmd->args[0], "[") == 0) {                /* the closing bracket is not an operand */
+        if(num_args == 0 || strcmp(cmd->args[num_args], "]") != 0) {
+            return 2;
+        }
+        num_args--;
+    }
+    return test_expression(cmd->args + 1, num_args);
+}
+
+/*
+ * This function checks the background processes and adds completed status if completed 
+ * @param - {sshell_job *} - the start of the job list
+ *    - {sshell_job *} - the end of the background processes
+ * @return - none
+ */
+void check_background_process(struct sshell_job *job_start, struct sshell_job *job_end) {
+    struct sshell_job *job;
+
+    /* check background processes */
+    for(job = job_start; job != job_end; job = job->next_job) {
+        sshell_poll(job);
+    }
+}
+
+/*
+ * This function checks if the line starts with the keyword and returns the rest of the line
+ * @param - {char *} - the line
+ *        - {const char *} - the keyword
+ * @return - {char *} - the rest of the line after the keyword, NULL if no match
+ */
+char *match_keyword(char *line, const char *keyword) {
+    int length = strlen(keyword);
+
+    for(; *line == ' ' || *line == '\t'; line++);            /* get rid of leading spaces and tabs */
+    if(strncmp(line, keyword, length) != 0 ||
+        (line[length] != 0 && line[length] != ' ' && line[length] != '\t')) {
+        return NULL;
+    }
+    for(line += length; *line == ' ' || *line == '\t'; line++);
+    return line;
+}
+
+/*
+ * This function checks if the line is a function header of the form "name() {"
+ * @param - {const char *} - the line
+ *        - {char *} - the buffer for the name of the function
+ * @return - {int} - one for a function header, zero otherwise
+ */
+int is_function_header(const char *line, char *name) {
+    int i = 0, j = 0;
+
+    for(; line[i] == ' ' || line[i] == '\t'; i++);
+    if(!isalpha(line[i]) && line[i] != '_') {
+        return 0;
+    }
+    while(isalnum(line[i]) || line[i] == '_') {
+        name[j++] = line[i++];
+    }
+    name[j] = 0;
+
+    for(; line[i] == ' ' || line[i] == '\t'; i++);
+    if(line[i++] != '(') {
+        return 0;
+    }
+    for(; line[i] == ' ' || line[i] == '\t'; i++);
+    if(line[i++] != ')') {
+        return 0;
+    }
+    for(; line[i] == ' ' || line[i] == '\t'; i++);
+    if(line[i++] != '{') {
+        return 0;
+    }
+    for(; line[i] == ' ' || line[i] == '\t'; i++);
+    return line[i] == 0;
+}
+
+/*
+ * This function checks if the line starts a block that spans several lines
+ * @param - {char *} - the line
+ * @return - {int} - one for a block, zero for a plain job
+ */
+int is_block_keyword(char *line) {
+    char name[MAX_CMD];
+    return match_keyword(line, "if") || match_keyword(line, "while") ||
+        match_keyword(line, "for") || is_function_header(line, name);
+}
+
+/*
+ * This function checks if the line starts with a keyword that can only close or split a block
+ * @param - {char *} - the line
+ * @return - {int} - one for a reserved word, zero otherwise
+ */
+int is_reserved_word(char *line) {
+    return match_keyword(line, "then") || match_keyword(line, "do") ||
+        match_keyword(line, "elif") || match_keyword(line, "else") ||
+        match_keyword(line, "fi") || match_keyword(line, "done") ||
+        match_keyword(line, "}");
+}
+
+/*
+ * This function creates a tree node
+ * @param - {int} - tree node code
+ *        - {sshell_job *} - the job of the node
+ * @return - {node *} - the node
+ */
+struct node *new_node(int type, struct sshell_job *job) {
+    struct node *node = (struct node*) malloc(sizeof(struct node));
+    node->type = type;
+    node->job = job;
+    node->body = NULL;
+    node->else_body = NULL;
+    node->words = NULL;
+    node->connector = LIST_END;
+    node->next_node = NULL;
+    node->next_tree = NULL;
+    return node;
+}
+
+/*
+ * This function parses and checks a job of a block once, the redirection files are opened when it runs
+ * @param - {char *} - the command line
+ *        - {int *} - the error code
+ * @return - {sshell_job *} - the checked job, NULL on error
+ */
+struct sshell_job *parse_block_job(char *line, int *error_code) {
+    struct sshell_job *job;
+
+    if(is_empty_command(line) || is_reserved_word(line)) {
+        *error_code = SSHELL_ERR_INVALID_CMDLINE;
+        return NULL;
+    }
+
+    job = parse_job(line);
+    *error_code = sshell_validate(job, 0);
+    if(*error_code != SSHELL_SUCCESS) {
+        free_job(job);
+        return NULL;
+    }
+    return job;
+}
+
+/*
+ * This function reads and parses the lines of a block until one of the end keywords
+ * @param - {shell *} - the shell
+ *        - {const char **} - NULL terminated array of the end keywords
+ *        - {char *} - the buffer for the line that ended the block
+ *        - {int *} - the error code
+ * @return - {node *} - the first node of the block
+ */
+struct node *parse_block(struct shell *shell, const char **ends, char *terminator, int *error_code) {
+    char line[MAX_CMD];
+    struct node *first_node = NULL, *last_node = NULL, *node;
+    int i;
+
+    *error_code = SSHELL_SUCCESS;
+    while(1) {
+        printf("> ");                                       /* Display continuation prompt */
+        if(read_line(shell, line) == EOF) {
+            *error_code = ERR_UNTERMINATED_BLOCK;
+            break;
+        }
+
+        /* skip empty lines and the optional then/do lines */
+        if(is_empty_command(line)) {
+            continue;
+        }
+        if((match_keyword(line, "then") && *match_keyword(line, "then") == 0) ||
+            (match_keyword(line, "do") && *match_keyword(line, "do") == 0)) {
+            continue;
+        }
+
+        /* end of the block */
+        for(i = 0; ends[i]; i++) {
+            if(match_keyword(line, ends[i])) {
+                strcpy(terminator, line);
+                return first_node;
+            }
+        }
+
+        node = parse_node(shell, line, error_code);
+        if(node == NULL) {
+            break;
+        }
+        if(last_node) {
+            last_node->next_node = node;
+        } else {
+            first_node = node;
+        }
+        for(last_node = node; last_node->next_node; last_node = last_node->next_node);    /* a list */
+    }
+    free_node(first_node);
+    return NULL;
+}
+
+/*
+ * This function parses an if (or elif) block
+ * @param - {shell *} - the shell
+ *        - {char *} - the condition command line
+ *        - {int *} - the error code
+ * @return - {node *} - the if node, NULL on error
+ */
+struct node *parse_if(struct shell *shell, char *condition, int *error_code) {
+    static const char *if_ends[] = {"elif", "else", "fi", NULL};
+    static const char *else_ends[] = {"fi", NULL};
+    char terminator[MAX_CMD];
+    char *rest;
+    struct node *node;
+    struct sshell_job *job;
+
+    job = parse_block_job(condition, error_code);
+    if(job == NULL) {
+        return NULL;
+    }
+    node = new_node(NODE_IF, job);
+
+    node->body = parse_block(shell, if_ends, terminator, error_code);
+    if(*error_code == SSHELL_SUCCESS) {
+        if((rest = match_keyword(terminator, "elif"))) {
+            node->else_body = parse_if(shell, rest, error_code);
+        } else if(match_keyword(terminator, "else")) {
+            node->else_body = parse_block(shell, else_ends, terminator, error_code);
+        }
+    }
+
+    if(*error_code != SSHELL_SUCCESS) {
+        free_node(node);
+        return NULL;
+    }
+    return node;
+}
+
+/*
+ * This function parses a line into a tree node, reading the rest of the block for control flow
+ * @param - {shell *} - the shell
+ *        - {char *} - the first line of the node
+ *        - {int *} - the error code
+ * @return - {node *} - the node, NULL on error
+ */
+struct node *parse_node(struct shell *shell, char *line, int *error_code) {
+    static const char *loop_ends[] = {"done", NULL};
+    static const char *function_ends[] = {"}", NULL};
+    char terminator[MAX_CMD], name[MAX_CMD];
+    char *rest;
+    struct node *node;
+    struct sshell_job *job;
+    int i;
+
+    *error_code = SSHELL_SUCCESS;
+    if((rest = match_keyword(line, "if"))) {                /* if condition */
+        return parse_if(shell, rest, error_code);
+    } else if((rest = match_keyword(line, "while"))) {      /* while condition */
+        job = parse_block_job(rest, error_code);
+        if(job == NULL) {
+            return NULL;
+        }
+        node = new_node(NODE_WHILE, job);
+        node->body = parse_block(shell, loop_ends, terminator, error_code);
+    } else if((rest = match_keyword(line, "for"))) {        /* for name in words */
+        for(i = 0; isalnum(rest[i]) || rest[i] == '_'; i++) {
+            name[i] = rest[i];
+        }
+        name[i] = 0;
+        rest = match_keyword(rest + i, "in");           /* any number of words */
+        if(i == 0 || isdigit(name[0]) || rest == NULL || strpbrk(rest, "<>|&")) {
+            *error_code = SSHELL_ERR_INVALID_CMDLINE;
+            return NULL;
+        }
+        node = new_node(NODE_FOR, parse_job(name));
+        node->words = strdup(rest);
+        node->body = parse_block(shell, loop_ends, terminator, error_code);
+    } else if(is_function_header(line, name)) {             /* name() { */
+        node = new_node(NODE_FUNCTION, parse_job(name));
+        node->body = parse_block(shell, function_ends, terminator, error_code);
+    } else {                                                /* a job, or a list of jobs */
+        return parse_list(line, error_code);
+    }
+
+    if(*error_code != SSHELL_SUCCESS) {
+        free_node(node);
+        return NULL;
+    }
+    return node;
+}
+
+/*
+ * This function finds the end of the parentheses of a process substitution, the braces of
+ *  branches or the quotes of a word, which belong to their job: `diff <(a ; b)`,
+ *  `a |{ b ; c }`, `sh -c "a ; b"`
+ * @param - {const char *} - the line
+ *        - {int} - index of the opening parenthesis, brace or quote
+ * @return - {int} - index after the closing one, or of the end of the line
+ */
+int skip_enclosed(const char *line, int i) {
+    char open = line[i], close = open == '(' ? ')' : open == '{' ? '}' : open;
+    int depth = 0;
+
+    if(open == '"' || open == '\'') {                   /* up to the same quote, nothing nests */
+        for(i++; line[i] && line[i] != close; i++);
+        return line[i] ? i + 1 : i;
+    }
+    for(; line[i]; i++) {
+        if(line[i] == '"' || line[i] == '\'') {
+            i = skip_enclosed(line, i) - 1;
+            continue;
+        }
+        depth += line[i] == open;
+        depth -= line[i] == close;
+        if(depth == 0) {
+            return i + 1;
+        }
+    }
+    return i;
+}
+
+/*
+ * This function checks if the line is a list: jobs separated by ;, &&, || or &
+ * @param - {const char *} - the line
+ * @return - {int} - one for a list, zero for a single job
+ */
+int is_list(const char *line) {
+    int i;
+
+    for(i = 0; line[i]; i++) {
+        if(strchr("({\"'", line[i])) {
+            i = skip_enclosed(line, i) - 1;
+        } else if(line[i] == ';' || (line[i] == '|' && line[i + 1] == '|')) {
+            return 1;
+        } else if(line[i] == '&') {
+            for(i++; line[i] == ' ' || line[i] == '\t'; i++);
+            return line[i] != 0;                            /* more after the first & */
+        }
+    }
+    return 0;
+}
+
+/*
+ * This function parses a line into the nodes of the jobs of its list, each parsed and
+ *  checked once: `a && b || c ; d & e`. A job ended by & runs in the background and the
+ *  next one runs at once. A line without ; && || or a & before its end gives one node
+ * @param - {char *} - the line
+ *        - {int *} - the error code
+ * @return - {node *} - the first node of the list, NULL on error
+ */
+struct node *parse_list(char *line, int *error_code) {
+    char element[MAX_CMD];
+    struct node *first_node = NULL, *last_node = NULL, *node;
+    struct sshell_job *job;
+    int i, start = 0, length, connector;
+
+    *error_code = SSHELL_SUCCESS;
+    while(1) {
+        /* find the end of the job */
+        for(i = start; line[i] && line[i] != ';' && line[i] != '&' &&
+            !(line[i] == '|' && line[i + 1] == '|'); i++) {
+            if(strchr("({\"'", line[i])) {
+                i = skip_enclosed(line, i) - 1;
+            }
+        }
+        length = i - start;
+        if(line[i] == 0) {
+            connector = LIST_END;
+        } else if(line[i] == ';') {
+            connector = LIST_SEQUENCE;
+            i++;
+        } else if(line[i] == '&' && line[i + 1] == '&') {
+            connector = LIST_AND;
+            i += 2;
+        } else if(line[i] == '|') {
+            connector = LIST_OR;
+            i += 2;
+        } else {                                            /* the & stays with its job */
+            connector = LIST_SEQUENCE;
+            length = ++i - start;
+        }
+        for(; length > 0 && (line[start] == ' ' || line[start] == '\t'); start++, length--);
+        for(; length > 0 && (line[start + length - 1] == ' ' || line[start + length - 1] == '\t'); length--);
+        snprintf(element, sizeof(element), "%.*s", length, line + start);
+        start = i;
+
+        /* a list may end with ; or &, nothing else may be empty */
+        if(connector == LIST_END && is_empty_command(element) && last_node &&
+            last_node->connector == LIST_SEQUENCE) {
+            last_node->connector = LIST_END;
+            return first_node;
+        }
+        job = parse_block_job(element, error_code);
+        if(job == NULL) {
+            free_node(first_node);
+            return NULL;
+        }
+        node = new_node(NODE_JOB, job);
+        node->connector = connector;
+        if(last_node) {
+            last_node->next_node = node;
+        } else {
+            first_node = node;
+        }
+        last_node = node;
+        if(connector == LIST_END) {
+            return first_node;
+        }
+    }
+}
+
+/*
+ * This function frees the memory allocated for the tree
+ * @param - {node *} - the first node of the tree
+ * @return - none
+ */
+void free_node(struct node *node) {
+    struct node *next;
+
+    while(node) {
+        next = node->next_node;
+        if(node->job) {
+            free_job(node->job);
+        }
+        free_node(node->body);
+        free_node(node->else_body);
+        free(node->words);
+        free(node);
+        node = next;
+    }
+}
+
+/*
+ * This function checks if the tree defines a function, so it has to be kept alive
+ * @param - {const node *} - the first node of the tree
+ * @return - {int} - one if a function is defined
+ */
+int contains_function(const struct node *node) {
+    for(; node; node = node->next_node) {
+        if(node->type == NODE_FUNCTION || contains_function(node->body) ||
+            contains_function(node->else_body)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * This function finds the function by name
+ * @param - {shell *} - the shell
+ *        - {const char *} - the name of the function
+ * @return - {function *} - the function, NULL if not defined
+ */
+struct function *find_function(struct shell *shell, const char *name) {
+    struct function *function = shell->first_function;
+    while(function && strcmp(function->name, name) != 0) {
+        function = function->next_function;
+    }
+    return function;
+}
+
+/*
+ * This function defines (or redefines) the function with the cached body
+ * @param - {shell *} - the shell
+ *        - {const char *} - the name of the function
+ *        - {node *} - the body of the function
+ * @return - none
+ */
+void define_function(struct shell *shell, const char *name, struct node *body) {
+    struct function *function = find_function(shell, name);
+
+    if(function == NULL) {
+        function = (struct function*) malloc(sizeof(struct function));
+        strcpy(function->name, name);
+        function->next_function = shell->first_function;
+        shell->first_function = function;
+    }
+    function->body = body;
+}
+
+/*
+ * This function runs the body of the function with the arguments of the command as $1, $2...
+ * @param - {shell *} - the shell
+ *        - {function *} - the function
+ *        - {sshell_command *} - the calling command
+ * @return - {int} - the exit status of the function
+ */
+int call_function(struct shell *shell, struct function *function, struct sshell_command *cmd) {
+    char **positional = shell->positional;
+    int num_positional = shell->num_positional;
+    int status;
+
+    shell->positional = cmd->args + 1;
+    shell->num_positional = cmd->num_args - 1;
+    status = execute_node(shell, function->body);
+    shell->positional = positional;
+    shell->num_positional = num_positional;
+
+    shell->last_status = status;
+    return status;
+}
+
+/*
+ * This function expands $NAME, $1..$9 and $? in the word
+ * @param - {shell *} - the shell
+ *        - {const char *} - the word
+ * @return - {char *} - the expanded word, allocated
+ */
+char *expand_word(struct shell *shell, const char *word) {
+    char name[MAX_CMD], number[16];
+    char *buffer = (char*) malloc(MAX_CMD);
+    const char *value;
+    size_t j = 0, size = MAX_CMD;
+    int i = 0, k, n;
+
+    while(word[i]) {
+        if(word[i] != '$') {
+            value = NULL;
+            buffer[j++] = word[i++];
+        } else if(word[++i] == '?') {                       /* last exit status */
+            snprintf(number, sizeof(number), "%d", shell->last_status);
+            value = number;
+            i++;
+        } else if(isdigit(word[i])) {                       /* positional argument */
+            n = word[i++] - '0';
+            if(n == 0) {
+                value = "sshell";
+            } else {
+                value = n <= shell->num_positional ? shell->positional[n - 1] : "";
+            }
+        } else if(isalpha(word[i]) || word[i] == '_') {     /* environment variable */
+            for(k = 0; (isalnum(word[i]) || word[i] == '_') && k < MAX_CMD - 1; k++) {
+                name[k] = word[i++];
+            }
+            name[k] = 0;
+            value = getenv(name);
+        } else {                                            /* a plain dollar sign */
+            value = "$";
+        }
+
+        /* a variable may hold more than a command line, the list of a for loop */
+        n = value ? strlen(value) : 0;
+        if(j + n + 2 > size) {
+            while(j + n + 2 > size) {
+                size *= 2;
+            }
+            buffer = (char*) realloc(buffer, size);
+            if(buffer == NULL) {
+                perror("realloc");
+                exit(EXIT_FAILURE);
+            }
+        }
+        memcpy(buffer + j, value ? value : "", n);
+        j += n;
+    }
+    buffer[j] = 0;
+    return buffer;
+}
+
+/*
+ * This function expands the words of a for loop and splits them at spaces, so that
+ *  `for i in $LIST` runs once for each word of LIST. A quoted word stays one word
+ * @param - {shell *} - the shell
+ *        - {const char *} - the words after `in`
+ *        - {int *} - number of words
+ * @return - {char **} - the words, allocated, grown as needed
+ */
+char **expand_words(struct shell *shell, const char *line, int *num_words) {
+    char *word = (char*) malloc(strlen(line) + 1), *expanded, *field, *save_field;
+    char **words = NULL;
+    char quote;
+    int i = 0, j, quoted, size = 0;
+
+    *num_words = 0;
+    while(line[i]) {
+        /* the next word, without its quotes as libsshell reads it */
+        for(; line[i] == ' ' || line[i] == '\t'; i++);
+        for(j = 0, quoted = 0; line[i] && line[i] != ' ' && line[i] != '\t'; ) {
+            if(line[i] == '\'' || line[i] == '"') {
+                quote = line[i++];
+                while(line[i] && line[i] != quote) {
+                    word[j++] = line[i++];
+                }
+                i += line[i] == quote;
+                quoted = 1;
+            } else {
+                word[j++] = line[i++];
+            }
+        }
+        word[j] = 0;
+        if(j == 0 && !quoted) {
+            break;
+        }
+
+        expanded = expand_word(shell, word);
+        for(field = quoted ? expanded : strtok_r(expanded, " \t\n", &save_field); field;
+            field = quoted ? NULL : strtok_r(NULL, " \t\n", &save_field)) {
+            if(*num_words == size) {
+                size = size ? 2 * size : MAX_ARGS;
+                words = (char**) realloc(words, size * sizeof(char*));
+                if(words == NULL) {
+                    perror("realloc");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            words[(*num_words)++] = strdup(field);
+        }
+        free(expanded);
+    }
+    free(word);
+    return words;
+}
+
+/*
+ * This function expands the arguments and the redirection files of the job, of its process
+ *  substitutions and of its branches
+ * @param - {shell *} - the shell
+ *        - {sshell_job *} - the job
+ * @return - none
+ */
+void expand_job(struct shell *shell, struct sshell_job *job) {
+    struct sshell_command *cmd;
+    int i;
+
+    for(cmd = job->first_command; cmd; cmd = cmd->next_command) {
+        for(i = 0; i < cmd->num_args; i++) {
+            expand_string(shell, job, &(cmd->args[i]));
+        }
+        for(i = 0; i < cmd->num_input; i++) {
+            expand_string(shell, job, &(cmd->input_file[i]));
+        }
+        for(i = 0; i < cmd->num_output; i++) {
+            expand_string(shell, job, &(cmd->output_file[i]));
+        }
+        for(i = 0; i < cmd->num_substitutions; i++) {
+            if(cmd->substitutions[i].job) {             /* NULL until the job is checked */
+                expand_job(shell, cmd->substitutions[i].job);
+            }
+        }
+        for(i = 0; i < cmd->num_branches; i++) {
+            if(cmd->branches[i]) {
+                expand_job(shell, cmd->branches[i]);
+            }
+        }
+    }
+}
+
+/*
+ * This function expands a string of the job in place, with the allocator of the job
+ * @param - {shell *} - the shell
+ *        - {const sshell_job *} - the job owning the string
+ *        - {char **} - the string, NULL for a missing file
+ * @return - none
+ */
+void expand_string(struct shell *shell, const struct sshell_job *job, char **word) {
+    char *expanded;
+
+    if(*word == NULL || strchr(*word, '$') == NULL) {
+        return;
+    }
+    expanded = expand_word(shell, *word);
+    sshell_release(job, *word);
+    *word = sshell_strdup(job, expanded);
+    free(expanded);
+}
+
+/*
+ * This function runs the nodes of the tree
+ * @param - {shell *} - the shell
+ *        - {node *} - the first node to run
+ * @return - {int} - the exit status of the last job
+ */
+int execute_node(struct shell *shell, struct node *node) {
+    char **words, *saved;
+    int i, num_words, status = EXIT_SUCCESS;
+
+    for(; node && !shell->exiting; node = node->next_node) {
+        switch(node->type) {
+            case NODE_JOB:                                  /* run a cached job, or a list of them */
+                if(node->connector != LIST_END) {
+                    status = execute_list(shell, &node);
+                } else {
+                    status = execute_cached_job(shell, node->job);
+                }
+                break;
+            case NODE_IF:                                   /* run the branch of the condition */
+                if(execute_cached_job(shell, node->job) == EXIT_SUCCESS) {
+                    status = execute_node(shell, node->body);
+                } else {
+                    status = execute_node(shell, node->else_body);
+                }
+                break;
+            case NODE_WHILE:                                /* run the body until the condition fails */
+                status = EXIT_SUCCESS;
+                while(!shell->exiting && execute_cached_job(shell, node->job) == EXIT_SUCCESS) {
+                    status = execute_node(shell, node->body);
+                }
+                break;
+            case NODE_FOR:                                  /* run the body for each word */
+                words = expand_words(shell, node->words, &num_words);
+                saved = getenv(node->job->commandline);     /* the variable is back as it was after the loop */
+                saved = saved ? strdup(saved) : NULL;
+                status = EXIT_SUCCESS;
+                for(i = 0; i < num_words; i++) {
+                    if(!shell->exiting) {
+                        setenv(node->job->commandline, words[i], 1);
+                        status = execute_node(shell, node->body);
+                    }
+                    free(words[i]);
+                }
+                free(words);
+                if(saved) {
+                    setenv(node->job->commandline, saved, 1);
+                    free(saved);
+                } else {
+                    unsetenv(node->job->commandline);
+                }
+                break;
+            case NODE_FUNCTION:                             /* define the function */
+                define_function(shell, node->job->commandline, node->body);
+                status = EXIT_SUCCESS;
+                break;
+        }
+        shell->last_status = status;
+    }
+    return status;
+}
+
+/*
+ * This function runs the jobs of a list, skipping a job after && when the last job failed and
+ *  after || when it succeeded. The jobs of the list are reaped and reported once at its end
+ * @param - {shell *} - the shell
+ *        - {node **} - the first node of the list, its last node once it ran
+ * @return - {int} - the exit status of the last job that ran
+ */
+int execute_list(struct shell *shell, struct node **list) {
+    struct node *node = *list;
+    int status = shell->last_status, run = 1;
+
+    shell->in_list++;
+    while(1) {
+        if(run) {
+            status = execute_cached_job(shell, node->job);
+            shell->last_status = status;
+        }
+        run = node->connector == LIST_AND ? status == EXIT_SUCCESS :
+            node->connector == LIST_OR ? status != EXIT_SUCCESS : 1;
+        if(node->connector == LIST_END || node->next_node == NULL || shell->exiting) {
+            break;
+        }
+        node = node->next_node;
+    }
+    *list = node;
+    shell->in_list--;
+
+    if(shell->in_list == 0 && shell->job_list) {            /* one pass for the whole list */
+        report_jobs(shell, NULL);
+    }
+    return status;
+}
+
+/*
+ * This function handles the timers that expired, checks the background jobs, prints
+ *  out the completed ones and starts the deferred jobs that are due
+ * @param - {shell *} - the shell
+ *        - {sshell_job *} - the job to stop checking at, NULL for all
+ * @return - none
+ */
+void report_jobs(struct shell *shell, struct sshell_job *job_end) {
+    if(events_pending(shell)) {
+        wait_events(shell, -1, 0);
+    }
+    if(shell->output.epoll_fd >= 0) {                   /* the rings of the jobs about to be reported */
+        drain_rings(shell);
+    }
+    check_background_process(shell->job_list->first_job, job_end);
+    process_complete_message(shell->job_list);
+    run_deferred(shell);
+}
+
+/*
+ * This function runs a copy of the cached job, so the tree can run it again
+ * @param - {shell *} - the shell
+ *        - {const sshell_job *} - the cached job
+ * @return - {int} - the exit status of the job
+ */
+int execute_cached_job(struct shell *shell, const struct sshell_job *job) {
+    struct sshell_job *copy = clone_job(job);
+    struct function *function;
+    int status, error_code;
+
+    expand_job(shell, copy);
+    error_code = read_timeout(copy);
+    if(error_code == SSHELL_SUCCESS) {
+        error_code = read_cache(shell, copy);
+    }
+    if(error_code != SSHELL_SUCCESS) {
+        error_message(error_code);
+        free_job(copy);
+        return EXIT_FAILURE;
+    }
+    if(copy->num_processes == 1 &&
+        (function = find_function(shell, copy->first_command->args[0]))) {
+        status = call_function(shell, function, copy->first_command);
+        free_job(copy);
+        return status;
+    }
+    return execute_job(shell, copy);
+}
+
+/*
+ * This function runs the builtin commands changing the shell in the shell, before each fork of sshell_spawn()
+ * @param - {void *} - the shell
+ *        - {sshell_job *} - the job of the command
+ *        - {sshell_command *} - the command
+ * @return - {int} - hook code
+ */
+int hook_in_caller(void *data, struct sshell_job *job, struct sshell_command *cmd) {
+    struct shell *shell = (struct shell*) data;
+    const struct builtin *builtin = find_builtin(shell, cmd->args[0]);
+
+    /* builtin commands changing the shell run in the shell, without a process */
+    if(builtin && builtin->flag == BUILTIN_SHELL) {
+        cmd->status = W_EXITCODE(builtin->run(shell, job, cmd), 0);
+        cmd->pid = 0;
+        cmd->finish = SSHELL_FINISHED;
+        return shell->exiting ? SSHELL_STOP : SSHELL_RAN;
+    }
+    fflush(stdout);                                     /* the child must not inherit buffered output */
+    return builtin ? SSHELL_FORK : SSHELL_SPAWN;        /* other builtin commands: no exec */
+}
+
+/*
+ * This function sets the child of sshell_spawn() up for job control
+ * @param - {void *} - the shell
+ *        - {sshell_job *} - the job of the child
+ *        - {sshell_command *} - the command of the child
+ * @return - none
+ */
+void hook_in_child(void *data, struct sshell_job *job, struct sshell_command *cmd) {
+    if(job_state(job)->cwd_fd >= 0) {                   /* a deferred job starts where it was entered */
+        fchdir(job_state(job)->cwd_fd);
+    }
+    if(job_state(job)->ring.write_fd >= 0) {            /* the pipelines and the redirections come after */
+        dup2(job_state(job)->ring.write_fd, STDOUT_FILENO);
+        dup2(job_state(job)->ring.write_fd, STDERR_FILENO);
+    }
+    child_setup((struct shell*) data, job, sshell_last_command(job)->background == 0);
+}
+
+/*
+ * This function runs a builtin command in the child of sshell_spawn(), after its redirections
+ * @param - {void *} - the shell
+ *        - {sshell_job *} - the job of the command
+ *        - {sshell_command *} - the builtin command
+ * @return - {int} - exit status of the builtin
+ */
+int hook_run_in_child(void *data, struct sshell_job *job, struct sshell_command *cmd) {
+    struct shell *shell = (struct shell*) data;
+    return find_builtin(shell, cmd->args[0])->run(shell, job, cmd);
+}
+
+/*
+ * This function relays the pipe after the command through its meter when the job is metered
+ * @param - {void *} - the shell
+ *        - {sshell_job *} - the job
+ *        - {sshell_command *} - the command writing to the pipe
+ *        - {int} - read end of the pipe
+ * @return - {int} - read end of the pipe for the next command
+ */
+int hook_on_pipe(void *data, struct sshell_job *job, struct sshell_command *cmd, int read_fd) {
+    if(job_state(job)->meters == NULL) {
+        return read_fd;
+    }
+    return start_meter((struct shell*) data, job, cmd, read_fd);
+}
+
+/*
+ * This function runs a checked job, it is owned by the job list afterwards
+ * @param - {shell *} - the shell
+ *        - {sshell_job *} - the job
+ * @return - {int} - the exit status of the last command, zero for background jobs
+ */
+int execute_job(struct shell *shell, struct sshell_job *job) {
+    int job_status = EXIT_SUCCESS;
+    struct job_list *job_list = shell->job_list;
+    struct sshell_command *cmd = job->first_command;
+    struct sshell_command *last_command = sshell_last_command(job);
+    const struct builtin *builtin = find_builtin(shell, cmd->args[0]);
+    struct sshell_hooks hooks = {shell, hook_in_caller, hook_in_child, hook_run_in_child, hook_on_pipe};
+
+    /* a background job waits while the system is under pressure */
+    if(last_command->background && !(job->num_processes == 1 && builtin && builtin->flag == BUILTIN_SHELL) &&
+        throttle_job(shell, job)) {
+        return EXIT_SUCCESS;
+    }
+
+    insert_job(&(job_list->first_job), job);            /* insert the job to the job list */
+    add_job_id(job_list, job);                          /* give the job its %n id */
+
+    if(job_state(job)->cache && lookup_result(job)) {
+        /* the cache replayed the output and the statuses: nothing runs */
+    } else if(job->num_processes == 1 && builtin &&
+        (builtin->flag == BUILTIN_SHELL || cmd->background == 0)) {
+        /* a single builtin command runs in the shell: no fork, no exec */
+        cmd->background = 0;
+        run_in_shell(shell, job, cmd, builtin);
+    } else {
+        if(shell->meter && job->num_processes > 1) {   /* shared with the meters of the pipes */
+            job_state(job)->meters = mmap(NULL, (job->num_processes - 1) * sizeof(struct pipe_meter),
+                PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+            if(job_state(job)->meters == MAP_FAILED) {
+                job_state(job)->meters = NULL;
+            }
+        }
+        if(last_command->background && shell->output.enabled) {   /* the output goes to a ring */
+            start_ring(shell, job);
+        }
+        job->grouped = shell->interactive;              /* job control only with a terminal */
+        sshell_spawn(job, &hooks);                      /* run the commands */
+        if(job_state(job)->ring.write_fd >= 0) {        /* only the children write to it */
+            close(job_state(job)->ring.write_fd);
+            job_state(job)->ring.write_fd = -1;
+        }
+        print_errors(job);                              /* the errors of the children before exec */
+    }
+    job->finish = sshell_check_finish(job);
+
+    /* the timeout runs from the start of the job */
+    if(job_state(job)->timeout == 0 && last_command->background) {
+        job_state(job)->timeout = shell->background_timeout;
+    }
+    if(job_state(job)->timeout > 0 && job->finish != SSHELL_FINISHED && job->pgid) {
+        arm_timer(shell, job, job_state(job)->timeout);
+    }
+
+    /* leave the shell */
+    if(shell->exiting) {
+        while(shell->output.first_kept) {
+            release_ring(shell, shell->output.first_kept);
+        }
+        free_job_list(job_list);
+        shell->job_list = NULL;
+        return EXIT_SUCCESS;
+    }
+
+    /* waiting */
+    if(last_command->background == 0) {
+        /* wait for the process group of the job */
+        wait_foreground(shell, job);
+        job_status = job->finish == SSHELL_FINISHED ?
+            sshell_exit_status(last_command->status) : 128 + SIGTSTP;
+        if(job_state(job)->timed_out) {                     /* the status of timeout(1) */
+            job_status = 124;
+        }
+    } else {
+        job_list->current = job;
+    }
+
+    /* handle the timers that expired meanwhile, check background processes and print out the completed ones */
+    if(shell->in_list == 0) {
+        report_jobs(shell, job);
+    }
+
+    shell->last_status = job_status;
+    return job_status;
+}
+
+/*
+ * This function parses, checks and runs one line entered at the prompt
+ * @param - {shell *} - the shell
+ *        - {char *} - the command line
+ * @return - none
+ */
+void run_line(struct shell *shell, char *line) {
+    struct sshell_job *job;
+    struct node *tree;
+    struct function *function;
+    int error_code;
+
+    /* control flow and lists: parse the whole block once and run the tree */
+    if(is_block_keyword(line) || is_list(line)) {
+        tree = parse_node(shell, line, &error_code);
+        if(tree == NULL) {
+            error_message(error_code);
+            return;
+        }
+        execute_node(shell, tree);
+
+        /* functions keep pointers into the tree */
+        if(contains_function(tree)) {
+            tree->next_tree = shell->first_tree;
+            shell->first_tree = tree;
+        } else {
+            free_node(tree);
+        }
+        return;
+    } else if(is_reserved_word(line)) {
+        error_message(SSHELL_ERR_INVALID_CMDLINE);
+        return;
+    }
+
+    job = parse_job(line);                              /* parse the job */
+
+    /* no command is entered */
+    if(is_empty_command(job->commandline)) {
+        /* check background processes to see if they are completed */
+        check_background_process(shell->job_list->first_job, NULL);
+
+        /* print out completed process message */
+        process_complete_message(shell->job_list);
+    
+        /* clear out allocated space for current job(which is empty) */
+        free_job(job);
+        return;
+    } 
+
+    /* check if input/output redirection has errors */
+    expand_job(shell, job);
+    error_code = read_timeout(job);
+    if(error_code == SSHELL_SUCCESS) {
+        error_code = read_cache(shell, job);
+    }
+    if(error_code == SSHELL_SUCCESS) {
+        error_code = sshell_validate(job, 1);
+    }
+    if(error_code != SSHELL_SUCCESS) {
+        /* prints out error message */
+        error_message(error_code);
+
+        /* clear out allocated space for current job */
+        free_job(job);
+        return;
+    }
+
+    /* call a function */
+    if(job->num_processes == 1 && (function = find_function(shell, job->first_command->args[0]))) {
+        call_function(shell, function, job->first_command);
+        free_job(job);
+        return;
+    }
+
+    execute_job(shell, job);
+}
+
+/*
+ * This function prints out according error mesage depending on error code
+ * @param - {int} - error code enum
+ * @return - none
+ */
+void error_message(int error_code) {
+    switch(error_code) {
+        case(ERR_DIR_NOTFOUND):
+            fprintf(stderr, "Error: no such directory\n");
+            break;
+        case(ERR_ACTIVE_JOBS):
+            fprintf(stderr, "Error: active jobs still running\n");
+            break;
+        case(ERR_UNTERMINATED_BLOCK):
+            fprintf(stderr, "Error: missing end of block\n");
+            break;
+        case(ERR_NO_SUCH_JOB):
+            fprintf(stderr, "Error: no such job\n");
+            break;
+        case(ERR_INVALID_SIGNAL):
+            fprintf(stderr, "Error: invalid signal\n");
+            break;
+        case(ERR_INVALID_DURATION):
+            fprintf(stderr, "Error: invalid duration\n");
+            break;
+        case(ERR_INVALID_SIZE):
+            fprintf(stderr, "Error: invalid size\n");
+            break;
+        case(ERR_INVALID_PERCENTAGE):
+            fprintf(stderr, "Error: invalid percentage\n");
+            break;
+        case(ERR_NOT_CAPTURED):
+            fprintf(stderr, "Error: output not captured\n");
+            break;
+        case(ERR_INVALID_FORMAT):
+            fprintf(stderr, "Error: invalid format\n");
+            break;
+        default:
+            if(error_code > SSHELL_FAILURE && error_code < SSHELL_NUM_ERRORS) {    /* error codes of the library */
+                fprintf(stderr, "Error: %s\n", sshell_strerror(error_code));
+            }
+            break;
+    }
+}
+
+/*
+ * This function prints out the errors of the commands that failed to start, and of their
+ *  process substitutions and branches
+ * @param - {const sshell_job *} - the spawned job
+ * @return - none
+ */
+void print_errors(const struct sshell_job *job) {
+    struct sshell_command *cmd;
+    int i;
+
+    for(cmd = job->first_command; cmd; cmd = cmd->next_command) {
+        for(i = 0; i < cmd->num_substitutions; i++) {
+            print_errors(cmd->substitutions[i].job);
+        }
+        for(i = 0; i < cmd->num_branches; i++) {
+            print_errors(cmd->branches[i]);
+        }
+        if(cmd->error != SSHELL_SUCCESS) {
+            error_message(cmd->error);
+        }
+    }
+}
+
+/*
+ * This function prints out the exit status of each command of the job, followed by the
+ *  statuses of its process substitutions in parentheses: [1]([0])([0]). Branches give
+ *  the statuses of each of their pipelines in braces: [0]{[0][0];[0]}
+ * @param - {const sshell_job *} - the finished job
+ * @return - none
+ */
+void print_statuses(const struct sshell_job *job) {
+    struct sshell_command *cmd;
+    int i;
+
+    for(cmd = job->first_command; cmd; cmd = cmd->next_command) {
+        if(cmd->num_branches > 0) {                     /* the relay has no status of its own */
+            for(i = 0; i < cmd->num_branches; i++) {
+                fprintf(stderr, i == 0 ? "{" : ";");
+                print_statuses(cmd->branches[i]);
+            }
+            fprintf(stderr, "}");
+            continue;
+        }
+        fprintf(stderr, "[%d]", sshell_exit_status(cmd->status));
+        for(i = 0; i < cmd->num_substitutions; i++) {
+            fprintf(stderr, "(");
+            print_statuses(cmd->substitutions[i].job);
+            fprintf(stderr, ")");
+        }
+    }
+}
+
+/*
+ * This function prints out any completed process info
+ * @param - {job_list *} - the job list
+ * @return - none
+ */
+void process_complete_message(struct job_list *job_list) {
+    /* Information message after execution */
+    struct sshell_job **first_job = &(job_list->first_job);
+    struct sshell_job *job_node = *first_job;
+    while(job_node) {
+        if(job_node->finish) {              /* print message for all completed processes */
+            fprintf(stderr, "+ completed '%s' ", job_node->commandline);
+            print_statuses(job_node);
+            if(job_state(job_node)->timed_out) { /* terminated by its timeout */
+                fprintf(stderr, " timed out");
+            }
+            fprintf(stderr, "\n");
+            if(job_state(job_node)->meters) {   /* print the throughput of the pipes */
+                meter_message(job_node);
+            }
+            if(job_state(job_node)->capture) {  /* keep the result for the next run */
+                store_result(job_node);
+            }
+            struct sshell_job *copy = job_node; /* copy it for deletion */
+            job_node = job_node->next_job;  /* go to the next job */
+            if(job_state(copy)->ring.unread) {  /* keep its id and tail until they are read */
+                unlink_job(first_job, copy);
+                keep_ring(job_list, copy);
+                continue;
+            }
+            remove_job_id(job_list, copy);  /* release the job id */
+            delete_job(first_job, copy);    /* delete the job if it is finished */
+        } else {
+            job_node = job_node->next_job;  /* go to the next job */
+        }
+    }
+}
+
+/*************************************************************
+ *                    RESULT CACHE                           *
+ *************************************************************/
+
+/*
+ * This function sets the result cache up: $SSHELL_CACHE, or sshell in the cache directory of
+ *  the user, created on the first store
+ * @param - {cache *} - the cache
+ * @return - none
+ */
+void init_cache(struct cache *cache) {
+    const char *dir;
+
+    memset(cache, 0, sizeof(struct cache));
+    cache->max_size = CACHE_SIZE;
+    if((dir = getenv("SSHELL_CACHE")) && *dir) {
+        snprintf(cache->dir, sizeof(cache->dir), "%s", dir);
+    } else if((dir = getenv("XDG_CACHE_HOME")) && *dir) {
+        snprintf(cache->dir, sizeof(cache->dir), "%s/sshell", dir);
+    } else if((dir = getenv("HOME")) && *dir) {
+        snprintf(cache->dir, sizeof(cache->dir), "%s/.cache/sshell", dir);
+    } else {
+        snprintf(cache->dir, sizeof(cache->dir), "/tmp/sshell-cache-%d", (int) getuid());
+    }
+    load_cache(cache);
+}
+
+/*
+ * This function counts the bytes of the entries of the cache, so a store does not scan the
+ *  directory, and removes the capture files of the shells that are gone
+ * @param - {cache *} - the cache
+ * @return - none
+ */
+void load_cache(struct cache *cache) {
+    DIR *dir = opendir(cache->dir);
+    struct dirent *dirent;
+    struct stat file;
+    long serial;
+    int pid;
+
+    cache->size = 0;
+    while(dir && (dirent = readdir(dir))) {
+        if(sscanf(dirent->d_name, "tmp.%d.%ld", &pid, &serial) == 2) {    /* a capture file */
+            if(pid != getpid() && kill(pid, 0) < 0 && errno == ESRCH) {
+                unlinkat(dirfd(dir), dirent->d_name, 0);
+            }
+        } else if(strlen(dirent->d_name) == CACHE_KEY - 1 &&
+            fstatat(dirfd(dir), dirent->d_name, &file, 0) == 0 && S_ISREG(file.st_mode)) {
+            cache->size += file.st_size;
+        }
+    }
+    if(dir) {
+        closedir(dir);
+    }
+}
+
+/*
+ * This function reads a size in bytes: a number with an optional k, m or g suffix
+ * @param - {const char *} - the size
+ *        - {long long *} - the bytes
+ * @return - {int} - error code
+ */
+int parse_size(const char *word, long long *size) {
+    char *end;
+
+    if(word == NULL || !isdigit((unsigned char) word[0])) {
+        return ERR_INVALID_SIZE;
+    }
+    *size = strtoll(word, &end, 10);
+    switch(tolower((unsigned char) *end)) {
+        case 'g': *size <<= 10;                     /* falls through */
+        case 'm': *size <<= 10;                     /* falls through */
+        case 'k': *size <<= 10; end++;              /* falls through */
+        case 0: break;
+        default: return ERR_INVALID_SIZE;
+    }
+    return *end == 0 ? SSHELL_SUCCESS : ERR_INVALID_SIZE;
+}
+
+/*
+ * This function adds bytes to a 128 bit FNV-1a hash
+ * @param - {unsigned __int128 *} - the hash
+ *        - {const void *} - the bytes
+ *        - {size_t} - number of bytes
+ * @return - none
+ */
+void hash_bytes(unsigned __int128 *hash, const void *data, size_t length) {
+    const unsigned char *byte = (const unsigned char*) data;
+    const unsigned __int128 prime = ((unsigned __int128) 1 << 88) + 0x13b;
+    size_t i;
+
+    for(i = 0; i < length; i++) {
+        *hash = (*hash ^ byte[i]) * prime;
+    }
+}
+
+/*
+ * This function adds a string and its null to the hash, so "ab" "c" and "a" "bc" differ
+ * @param - {unsigned __int128 *} - the hash
+ *        - {const char *} - the string
+ * @return - none
+ */
+void hash_string(unsigned __int128 *hash, const char *string) {
+    hash_bytes(hash, string, strlen(string) + 1);
+}
+
+/*
+ * This function adds a file to the hash: its contents, or only its size and modification time
+ * @param - {unsigned __int128 *} - the hash
+ *        - {const char *} - the path of the file
+ *        - {int} - one to hash the modification time instead of the contents
+ * @return - none
+ */
+void hash_file(unsigned __int128 *hash, const char *path, int by_mtime) {
+    char buffer[65536];
+    struct stat file;
+    ssize_t n;
+    int fd;
+
+    if(stat(path, &file) < 0) {                     /* a missing file is part of the key too */
+        hash_string(hash, "\001missing");
+        return;
+    }
+    hash_bytes(hash, &file.st_size, sizeof(file.st_size));
+    if(by_mtime) {
+        hash_bytes(hash, &file.st_dev, sizeof(file.st_dev));
+        hash_bytes(hash, &file.st_ino, sizeof(file.st_ino));
+        hash_bytes(hash, &file.st_mtim, sizeof(file.st_mtim));
+        return;
+    }
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    while(fd >= 0 && (n = read(fd, buffer, sizeof(buffer))) > 0) {
+        hash_bytes(hash, buffer, n);
+    }
+    if(fd >= 0) {
+        close(fd);
+    }
+}
+
+/*
+ * This function checks that the command reads only what the key covers: input files that are
+ *  regular files, or /dev/null, and not the stdin of the shell
+ * @param - {const sshell_command *} - the first command of the job
+ * @return - {int} - one if the input is in the key
+ */
+int input_in_key(const struct sshell_command *cmd) {
+    struct stat file;
+    int i;
+
+    if(cmd->num_input == 0) {                       /* a terminal, a pipe or the rest of the script */
+        return 0;
+    }
+    for(i = 0; i < cmd->num_input; i++) {
+        if(cmd->input_file[i] == NULL || (strcmp(cmd->input_file[i], "/dev/null") != 0 &&
+            (stat(cmd->input_file[i], &file) < 0 || !S_ISREG(file.st_mode)))) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * This function takes the cache prefix off the job and gives the job its key:
+ *  cache [-m] [-e VAR]... [-d FILE]... cmd... The key covers the working directory, the
+ *  arguments of every command, the VAR variables, and the input files and the FILE
+ *  dependencies by contents, or by modification time with -m. A job whose first command reads
+ *  anything else runs without the cache
+ * @param - {shell *} - the shell
+ *        - {sshell_job *} - the job
+ * @return - {int} - error code
+ */
+int read_cache(struct shell *shell, struct sshell_job *job) {
+    struct sshell_command *cmd = job->first_command, *node;
+    const struct builtin *builtin;
+    int i = 1, j, by_mtime = 0;
+
+    if(strcmp(cmd->args[0], "cache") != 0) {
+        return SSHELL_SUCCESS;
+    }
+    while(cmd->args[i] && (strcmp(cmd->args[i], "-m") == 0 ||
+        ((strcmp(cmd->args[i], "-e") == 0 || strcmp(cmd->args[i], "-d") == 0) && cmd->args[i + 1]))) {
+        by_mtime |= strcmp(cmd->args[i], "-m") == 0;
+        i += strcmp(cmd->args[i], "-m") == 0 ? 1 : 2;
+    }
+    if(cmd->args[i] == NULL || cmd->args[i][0] == '-') {
+        return i == 1 ? SSHELL_SUCCESS : SSHELL_ERR_INVALID_CMDLINE;   /* the cache builtin itself */
+    }
+    builtin = find_builtin(shell, cmd->args[i]);
+    if(builtin && builtin->flag == BUILTIN_SHELL) {     /* a replay cannot change the shell */
+        return SSHELL_ERR_INVALID_CMDLINE;
+    }
+    for(node = cmd; node; node = node->next_command) {
+        /* nor know what a process substitution reads, nor capture the output of branches */
+        if(node->num_substitutions > 0 || node->num_branches > 0) {
+            return SSHELL_ERR_INVALID_CMDLINE;
+        }
+    }
+
+    if(!input_in_key(cmd)) {
+        fprintf(stderr, "+ not cached: the input is not a file\n");
+    } else {
+        set_cache_key(shell, job, i, by_mtime);
+    }
+
+    /* the command starts after the options */
+    for(j = 0; j < i; j++) {
+        sshell_release(job, cmd->args[j]);
+    }
+    cmd->num_args -= i;
+    memmove(cmd->args, cmd->args + i, (cmd->num_args + 1) * sizeof(char *));
+    return SSHELL_SUCCESS;
+}
+
+/*
+ * This function gives the cached job its key
+ * @param - {shell *} - the shell
+ *        - {sshell_job *} - the job
+ *        - {int} - index of the first argument after the cache options
+ *        - {int} - one to hash the modification time of the files instead of the contents
+ * @return - none
+ */
+void set_cache_key(struct shell *shell, struct sshell_job *job, int i, int by_mtime) {
+    struct sshell_command *cmd = job->first_command, *node;
+    unsigned __int128 hash = ((unsigned __int128) 0x6c62272e07bb0142ULL << 64) | 0x62b821756295c58dULL;
+    char cwd[PATH_MAX];
+    const char *value;
+    int j;
+
+    hash_string(&hash, "sshell-cache 1");
+    hash_string(&hash, getcwd(cwd, sizeof(cwd)) ? cwd : "");
+    for(j = 1; j < i; j += strcmp(cmd->args[j], "-m") == 0 ? 1 : 2) {
+        if(strcmp(cmd->args[j], "-e") == 0) {
+            value = getenv(cmd->args[j + 1]);
+            hash_string(&hash, cmd->args[j + 1]);
+            hash_string(&hash, value ? value : "\001unset");
+        } else if(strcmp(cmd->args[j], "-d") == 0) {
+            hash_string(&hash, cmd->args[j + 1]);
+            hash_file(&hash, cmd->args[j + 1], by_mtime);
+        }
+    }
+    for(node = cmd; node; node = node->next_command) {
+        for(j = node == cmd ? i : 0; j < node->num_args; j++) {
+            hash_string(&hash, node->args[j]);
+        }
+        hash_string(&hash, "|");
+        for(j = 0; j < node->num_input; j++) {      /* the input is fed by contents, not by name */
+            hash_file(&hash, node->input_file[j], by_mtime);
+        }
+    }
+    snprintf(job_state(job)->cache_key, CACHE_KEY, "%016llx%016llx",
+        (unsigned long long) (hash >> 64), (unsigned long long) hash);
+    job_state(job)->cache = &shell->cache;
+}
+
+/*
+ * This function copies part of a file without going through user space when it can
+ * @param - {int} - the file
+ *        - {off_t} - where the part starts
+ *        - {off_t} - length of the part
+ *        - {int} - the target
+ * @return - {int} - zero on success, -1 on error
+ */
+int copy_range(int in_fd, off_t offset, off_t length, int out_fd) {
+    char buffer[65536];
+    off_t end = offset + length;
+    ssize_t n, done, written;
+
+    while(offset < end) {
+        n = sendfile(out_fd, in_fd, &offset, end - offset);
+        if(n < 0 && errno == EINTR) {
+            continue;
+        }
+        if(n < 0 && (errno == EINVAL || errno == ENOSYS)) { /* the target takes write() only */
+            n = pread(in_fd, buffer, end - offset < sizeof(buffer) ? end - offset : sizeof(buffer), offset);
+            for(done = 0; n > 0 && done < n; done += written) {
+                written = write(out_fd, buffer + done, n - done);
+                if(written < 0) {
+                    return -1;
+                }
+            }
+            offset += n > 0 ? n : 0;
+        }
+        if(n <= 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * This function creates a directory and the directories above it
+ * @param - {const char *} - the path of the directory
+ * @return - {int} - zero on success, -1 on error
+ */
+int make_dirs(const char *path) {
+    char dir[PATH_MAX];
+    char *slash;
+
+    snprintf(dir, sizeof(dir), "%s", path);
+    for(slash = strchr(dir + 1, '/'); slash; slash = strchr(slash + 1, '/')) {
+        *slash = 0;
+        mkdir(dir, S_IRWXU);
+        *slash = '/';
+    }
+    return mkdir(dir, S_IRWXU) == 0 || errno == EEXIST ? 0 : -1;
+}
+
+/*
+ * This function replays the stored result of the job: the output goes to the output files of
+ *  the last command, or to the standard output, and the commands get their stored statuses.
+ *  An entry is the output followed by the trailer `sshell-cache 1 N STATUS...\n` and its
+ *  length as "%08x\n". On a miss the job captures its output for store_result()
+ * @param - {sshell_job *} - the cached job
+ * @return - {int} - one if the result was replayed, zero if the job must run
+ */
+int lookup_result(struct sshell_job *job) {
+    struct job_state *state = job_state(job);
+    struct sshell_command *cmd, *last_command = sshell_last_command(job);
+    char path[PATH_MAX], trailer[MAX_CMD * 4];
+    char *word;
+    struct stat entry;
+    long long trailer_len = 0;
+    int fd, out_fd, i, num_statuses = -1, statuses[MAX_CMD];
+
+    snprintf(path, sizeof(path), "%s/%s", state->cache->dir, state->cache_key);
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    /* read the trailer */
+    if(fd >= 0 && fstat(fd, &entry) == 0 && entry.st_size >= CACHE_FOOTER &&
+        pread(fd, trailer, CACHE_FOOTER, entry.st_size - CACHE_FOOTER) == CACHE_FOOTER) {
+        trailer[CACHE_FOOTER - 1] = 0;
+        trailer_len = strtoll(trailer, NULL, 16);
+    }
+    if(trailer_len > 0 && trailer_len < sizeof(trailer) && trailer_len + CACHE_FOOTER <= entry.st_size &&
+        pread(fd, trailer, trailer_len, entry.st_size - CACHE_FOOTER - trailer_len) == trailer_len) {
+        trailer[trailer_len] = 0;
+        if(strncmp(trailer, "sshell-cache 1 ", 15) == 0) {
+            num_statuses = strtol(trailer + 15, &word, 10);
+            for(i = 0; i < num_statuses && i < MAX_CMD; i++) {
+                statuses[i] = strtol(word, &word, 10);
+            }
+        }
+    }
+    if(num_statuses != job->num_processes) {        /* a miss, or an entry of another shape */
+        if(fd >= 0) {
+            close(fd);
+        }
+        state->cache->misses++;
+        capture_result(job);
+        return 0;
+    }
+
+    /* replay the output */
+    fflush(stdout);
+    if(last_command->num_output == 0) {
+        copy_range(fd, 0, entry.st_size - CACHE_FOOTER - trailer_len, STDOUT_FILENO);
+    }
+    for(i = 0; i < last_command->num_output; i++) {
+        /* sendfile() refuses O_APPEND files, copy_range() then writes them */
+        out_fd = open(last_command->output_file[i], O_WRONLY | O_CREAT | O_CLOEXEC |
+            (last_command->output_append[i] ? O_APPEND : O_TRUNC), S_IRUSR | S_IWUSR);
+        if(out_fd < 0) {
+            error_message(SSHELL_ERR_OPEN_OUTPUTFILE);
+            continue;
+        }
+        copy_range(fd, 0, entry.st_size - CACHE_FOOTER - trailer_len, out_fd);
+        close(out_fd);
+    }
+    futimens(fd, NULL);                             /* the entry was used: last to be evicted */
+    close(fd);
+
+    for(cmd = job->first_command, i = 0; cmd; cmd = cmd->next_command, i++) {
+        cmd->pid = 0;                               /* no process to wait for */
+        cmd->status = W_EXITCODE(statuses[i], 0);
+        cmd->finish = SSHELL_FINISHED;
+    }
+    state->cache->hits++;
+    return 1;
+}
+
+/*
+ * This function makes the last command of the job also write to a capture file of the cache,
+ *  through the fan out of its output files. Without output files it also writes to /dev/stdout
+ * @param - {sshell_job *} - the cached job
+ * @return - none
+ */
+void capture_result(struct sshell_job *job) {
+    struct job_state *state = job_state(job);
+    struct sshell_command *last_command = sshell_last_command(job);
+    char path[PATH_MAX];
+    int fd, n = last_command->num_output;
+
+    if(n + 2 > MAX_ARGS || make_dirs(state->cache->dir) < 0) {  /* runs without the cache */
+        return;
+    }
+    snprintf(path, sizeof(path), "%s/tmp.%d.%ld", state->cache->dir, (int) getpid(), state->cache->serial++);
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if(fd < 0) {
+        return;
+    }
+    close(fd);
+    state->capture = strdup(path);
+
+    if(n == 0) {                                    /* appending leaves a redirected shell alone */
+        last_command->output_file[n] = sshell_strdup(job, "/dev/stdout");
+        last_command->output_append[n++] = 1;
+    }
+    last_command->output_file[n] = sshell_strdup(job, path);
+    last_command->output_append[n++] = 0;
+    last_command->num_output = n;
+}
+
+/*
+ * This function stores the result of a finished cached job, unless a command failed to start,
+ *  exited with a non-zero status, was killed or timed out. Once the entries are over the size limit the least recently used
+ *  ones are evicted down to 90% of it, so the directory is not scanned on every store
+ * @param - {sshell_job *} - the finished job
+ * @return - none
+ */
+void store_result(struct sshell_job *job) {
+    struct job_state *state = job_state(job);
+    struct sshell_command *cmd;
+    char path[PATH_MAX], trailer[MAX_CMD * 4];
+    struct stat entry, old_entry;
+    int fd = -1, length, stored = 0;
+
+    length = snprintf(trailer, sizeof(trailer), "sshell-cache 1 %d", job->num_processes);
+    for(cmd = job->first_command; cmd; cmd = cmd->next_command) {
+        if(cmd->error != SSHELL_SUCCESS || cmd->status != 0) {
+            break;                                  /* a failure may not happen again, relayed kills exit 128 + sig */
+        }
+        length += snprintf(trailer + length, sizeof(trailer) - length, " %d", WEXITSTATUS(cmd->status));
+    }
+    length += snprintf(trailer + length, sizeof(trailer) - length, "\n");
+    length += snprintf(trailer + length, sizeof(trailer) - length, "%08x\n", length);
+
+    if(cmd == NULL && !state->timed_out) {
+        fd = open(state->capture, O_WRONLY | O_APPEND | O_CLOEXEC);
+    }
+    if(fd >= 0) {
+        snprintf(path, sizeof(path), "%s/%s", state->cache->dir, state->cache_key);
+        if(stat(path, &old_entry) < 0) {            /* an entry of the same key is replaced */
+            old_entry.st_size = 0;
+        }
+        stored = write(fd, trailer, length) == length && fstat(fd, &entry) == 0 &&
+            rename(state->capture, path) == 0;
+        close(fd);
+    }
+    if(stored) {
+        state->cache->stores++;
+        state->cache->size += entry.st_size - old_entry.st_size;
+        if(state->cache->size > state->cache->max_size) {
+            evict_results(state->cache, state->cache->max_size - state->cache->max_size / 10);
+        }
+    } else {
+        unlink(state->capture);
+    }
+    free(state->capture);
+    state->capture = NULL;
+}
+
+/*
+ * This function lists the entries of the cache
+ * @param - {const cache *} - the cache
+ *        - {cache_entry **} - the array of the entries, to free
+ *        - {long long *} - bytes of the entries
+ * @return - {int} - number of entries
+ */
+int list_results(const struct cache *cache, struct cache_entry **entries, long long *total) {
+    DIR *dir = opendir(cache->dir);
+    struct dirent *dirent;
+    struct stat file;
+    int num_entries = 0, capacity = 0;
+
+    *entries = NULL;
+    *total = 0;
+    while(dir && (dirent = readdir(dir))) {
+        if(strlen(dirent->d_name) != CACHE_KEY - 1 ||        /* the capture files */
+            fstatat(dirfd(dir), dirent->d_name, &file, 0) < 0 || !S_ISREG(file.st_mode)) {
+            continue;
+        }
+        if(num_entries == capacity) {
+            capacity = capacity ? 2 * capacity : 64;
+            *entries = (struct cache_entry*) realloc(*entries, capacity * sizeof(struct cache_entry));
+        }
+        strcpy((*entries)[num_entries].name, dirent->d_name);
+        (*entries)[num_entries].used = file.st_mtim;
+        (*entries)[num_entries].size = file.st_size;
+        *total += file.st_size;
+        num_entries++;
+    }
+    if(dir) {
+        closedir(dir);
+    }
+    return num_entries;
+}
+
+/*
+ * This function orders the entries from the least recently used, for qsort
+ */
+int compare_entries(const void *a, const void *b) {
+    const struct timespec *x = &((const struct cache_entry*) a)->used;
+    const struct timespec *y = &((const struct cache_entry*) b)->used;
+
+    if(x->tv_sec != y->tv_sec) {
+        return x->tv_sec < y->tv_sec ? -1 : 1;
+    }
+    return (x->tv_nsec > y->tv_nsec) - (x->tv_nsec < y->tv_nsec);
+}
+
+/*
+ * This function removes the least recently used entries until the cache fits in the size, and
+ *  counts the bytes of the entries again, since other shells may share the directory
+ * @param - {cache *} - the cache
+ *        - {long long} - bytes the entries may take
+ * @return - none
+ */
+void evict_results(struct cache *cache, long long max_size) {
+    struct cache_entry *entries;
+    char path[PATH_MAX];
+    long long total;
+    int i, num_entries = list_results(cache, &entries, &total);
+
+    qsort(entries, num_entries, sizeof(struct cache_entry), compare_entries);
+    for(i = 0; i < num_entries && total > max_size; i++) {
+        snprintf(path, sizeof(path), "%s/%s", cache->dir, entries[i].name);
+        if(unlink(path) == 0) {
+            total -= entries[i].size;
+            cache->evictions++;
+        }
+    }
+    cache->size = total;
+    free(entries);
+}
+
+/*
+ * This function prints out the cache and its statistics, or changes it:
+ *  cache [-p DIR] [-s SIZE] [-c]
+ * @param - {shell *} - the shell
+ *        - {sshell_job *} - the job running the builtin
+ *        - {sshell_command *} - the cache command
+ * @return - {int} - return success or failure status
+ */
+int builtin_cache(struct shell *shell, struct sshell_job *self, struct sshell_command *cmd) {
+    struct cache *cache = &shell->cache;
+    struct cache_entry *entries;
+    long long total, size;
+    int i, num_entries, error_code;
+
+    if(cmd->args[1] == NULL) {
+        num_entries = list_results(cache, &entries, &total);
+        free(entries);
+        printf("cache %s: %d entries, %lld of %lld bytes\n", cache->dir, num_entries, total, cache->max_size);
+        printf("hits %ld, misses %ld, stores %ld, evictions %ld\n",
+            cache->hits, cache->misses, cache->stores, cache->evictions);
+        return EXIT_SUCCESS;
+    }
+    for(i = 1; i < cmd->num_args; i++) {
+        if(strcmp(cmd->args[i], "-p") == 0 && cmd->args[i + 1]) {          /* another directory */
+            snprintf(cache->dir, sizeof(cache->dir), "%s", cmd->args[++i]);
+            load_cache(cache);
+        } else if(strcmp(cmd->args[i], "-s") == 0 && cmd->args[i + 1]) {   /* another size limit */
+            error_code = parse_size(cmd->args[++i], &size);
+            if(error_code != SSHELL_SUCCESS) {
+                error_message(error_code);
+                return EXIT_FAILURE;
+            }
+            cache->max_size = size;
+            evict_results(cache, size);
+        } else if(strcmp(cmd->args[i], "-c") == 0) {                       /* forget everything */
+            evict_results(cache, -1);
+        } else {
+            error_message(SSHELL_ERR_INVALID_CMDLINE);
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+/*************************************************************
+ *                    THROTTLE                               *
+ *************************************************************/
+
+/*
+ * This function initializes the throttle: no limits, the pressure of the whole system
+ * @param - {throttle *} - the throttle
+ * @return - none
+ */
+void init_throttle(struct throttle *throttle) {
+    memset(throttle, 0, sizeof(struct throttle));
+    strcpy(throttle->memory_path, "/proc/pressure/memory");
+    strcpy(throttle->cpu_path, "/proc/pressure/cpu");
+    throttle->interval = THROTTLE_INTERVAL;
+    throttle->memory = -1;
+    throttle->cpu = -1;
+    throttle->timer_fd = -1;
+}
+
+/*
+ * This function reads the share of time some task stalled in the last ten seconds
+ *  from a pressure stall information file: some avg10=1.23 avg60=... avg300=... total=...
+ * @param - {const char *} - the path of the file
+ * @return - {double} - the percentage, -1 if the file cannot be read
+ */
+double read_pressure(const char *path) {
+    char line[256];
+    double avg10 = -1;
+    FILE *file = fopen(path, "re");
+
+    if(file == NULL) {
+        return -1;
+    }
+    while(fgets(line, sizeof(line), file)) {
+        if(sscanf(line, "some avg10=%lf", &avg10) == 1) {
+            break;
+        }
+    }
+    fclose(file);
+    return avg10;
+}
+
+/*
+ * This function reads the pressure and checks it against the limits, an unreadable
+ *  file never holds the jobs back
+ * @param - {throttle *} - the throttle
+ * @return - {int} - one if a limit is exceeded
+ */
+int over_pressure(struct throttle *throttle) {
+    throttle->memory = read_pressure(throttle->memory_path);
+    throttle->cpu = read_pressure(throttle->cpu_path);
+    return (throttle->memory_limit > 0 && throttle->memory > throttle->memory_limit) ||
+        (throttle->cpu_limit > 0 && throttle->cpu > throttle->cpu_limit);
+}
+
+/*
+ * This function defers a background job while the system is under pressure, or while
+ *  earlier jobs wait so that they start in order. The timer of the throttle ticks every
+ *  interval while jobs wait and run_deferred() starts them one by one
+ * @param - {shell *} - the shell
+ *        - {sshell_job *} - the job
+ * @return - {int} - one if the job was deferred, the throttle then owns it
+ */
+int throttle_job(struct shell *shell, struct sshell_job *job) {
+    struct throttle *throttle = &shell->throttle;
+    struct job_state *state = job_state(job);
+    struct itimerspec value;
+    struct epoll_event event;
+
+    if(state->deferred || (throttle->memory_limit <= 0 && throttle->cpu_limit <= 0)) {
+        return 0;
+    }
+    if(throttle->first_deferred == NULL && !over_pressure(throttle)) {
+        return 0;
+    }
+
+    if(throttle->timer_fd < 0) {
+        throttle->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if(throttle->timer_fd < 0) {
+            return 0;                                   /* no way to come back: start it now */
+        }
+        event.events = EPOLLIN;
+        event.data.ptr = throttle;
+        epoll_ctl(shell->events_fd, EPOLL_CTL_ADD, throttle->timer_fd, &event);
+    }
+    if(throttle->first_deferred == NULL) {              /* tick every interval */
+        value.it_value.tv_sec = (time_t) throttle->interval;
+        value.it_value.tv_nsec = (long) ((throttle->interval - value.it_value.tv_sec) * 1e9);
+        if(value.it_value.tv_sec == 0 && value.it_value.tv_nsec == 0) {
+            value.it_value.tv_nsec = 1;                 /* zero would disarm it */
+        }
+        value.it_interval = value.it_value;
+        timerfd_settime(throttle->timer_fd, 0, &value, NULL);
+    }
+
+    /* the job starts later in the directory it was entered in */
+    state->deferred = 1;
+    state->cwd_fd = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+    job->next_job = NULL;
+    if(throttle->last_deferred) {
+        throttle->last_deferred->next_job = job;
+    } else {
+        throttle->first_deferred = job;
+    }
+    throttle->last_deferred = job;
+    throttle->num_deferred++;
+    add_job_id(shell->job_list, job);                   /* jobs, wait and kill see it */
+    shell->job_list->current = job;
+    fprintf(stderr, "+ deferred '%s'\n", job->commandline);
+    return 1;
+}
+
+/*
+ * This function starts the deferred jobs that are due: one per tick of the timer while
+ *  the pressure is under the limits, all of them once the limits are off. It runs between
+ *  jobs and never while the shell waits for a foreground job
+ * @param - {shell *} - the shell
+ * @return - none
+ */
+void run_deferred(struct shell *shell) {
+    struct throttle *throttle = &shell->throttle;
+    struct sshell_job *job;
+    uint64_t expirations;
+    int off, status = shell->last_status;
+
+    if(throttle->first_deferred == NULL || throttle->launching) {
+        return;
+    }
+    if(read(throttle->timer_fd, &expirations, sizeof(expirations)) > 0) {  /* a tick wait_events() missed */
+        throttle->due = 1;
+    }
+
+    throttle->launching = 1;
+    while(throttle->first_deferred) {
+        off = throttle->memory_limit <= 0 && throttle->cpu_limit <= 0;
+        if(!off && (!throttle->due || over_pressure(throttle))) {
+            break;
+        }
+        throttle->due = 0;
+        job = throttle->first_deferred;
+        dequeue_job(throttle, job);
+        execute_job(shell, job);
+    }
+    throttle->launching = 0;
+    shell->last_status = status;                        /* a deferred job is still a background job */
+}
+
+/*
+ * This function takes the job out of the queue of the throttle, and stops the ticks once
+ *  nothing waits
+ * @param - {throttle *} - the throttle
+ *        - {sshell_job *} - the deferred job
+ * @return - none
+ */
+void dequeue_job(struct throttle *throttle, struct sshell_job *job) {
+    struct sshell_job **link = &throttle->first_deferred, *previous = NULL;
+    struct itimerspec value;
+
+    for(; *link && *link != job; link = &((*link)->next_job)) {
+        previous = *link;
+    }
+    if(*link == NULL) {
+        return;
+    }
+    *link = job->next_job;
+    if(throttle->last_deferred == job) {
+        throttle->last_deferred = previous;
+    }
+    job->next_job = NULL;
+    job_state(job)->deferred = 2;
+
+    if(throttle->first_deferred == NULL) {              /* nothing waits: stop the ticks */
+        memset(&value, 0, sizeof(value));
+        timerfd_settime(throttle->timer_fd, 0, &value, NULL);
+        throttle->due = 0;
+    }
+}
+
+/*
+ * This function waits in the event loop until the deferred job started, or until every
+ *  deferred job started, launching them as they are due
+ * @param - {shell *} - the shell
+ *        - {sshell_job *} - the job, NULL for all of them
+ * @return - none
+ */
+void wait_deferred(struct shell *shell, struct sshell_job *job) {
+    if(shell->throttle.launching) {                     /* a deferred job waits for the others */
+        return;
+    }
+    run_deferred(shell);
+    while(job ? job_state(job)->deferred == 1 : shell->throttle.first_deferred != NULL) {
+        wait_events(shell, -1, -1);
+        run_deferred(shell);
+    }
+}
+
+/*
+ * This function starts a deferred job now, whatever the pressure
+ * @param - {shell *} - the shell
+ *        - {sshell_job *} - the deferred job
+ *        - {int} - one to run it in the foreground and wait for it
+ * @return - {int} - exit status of the job, zero in the background
+ */
+int start_deferred(struct shell *shell, struct sshell_job *job, int foreground) {
+    dequeue_job(&shell->throttle, job);
+    if(foreground) {
+        sshell_last_command(job)->background = 0;
+    }
+    return execute_job(shell, job);
+}
+
+/*
+ * This function prints out the pressure, the limits and the deferred jobs, or changes the
+ *  throttle: throttle [-m PCT] [-c PCT] [-M FILE] [-C FILE] [-i DURATION]
+ * @param - {shell *} - the shell
+ *        - {sshell_job *} - the job running the builtin
+ *        - {sshell_command *} - the throttle command
+ * @return - {int} - return success or failure status
+ */
+int builtin_throttle(struct shell *shell, struct sshell_job *self, struct sshell_command *cmd) {
+    struct throttle *throttle = &shell->throttle;
+    struct sshell_job *job;
+    double value, *limit;
+    char *end;
+    int i, error_code;
+
+    if(cmd->args[1] == NULL) {
+        over_pressure(throttle);
+        printf("memory %s: %.2f%%, limit %.2f%%\n", throttle->memory_path, throttle->memory, throttle->memory_limit);
+        printf("cpu %s: %.2f%%, limit %.2f%%\n", throttle->cpu_path, throttle->cpu, throttle->cpu_limit);
+        printf("interval %gs, deferred %ld\n", throttle->interval, throttle->num_deferred);
+        for(job = throttle->first_deferred; job; job = job->next_job) {
+            printf("[%d] waiting '%s'\n", job_state(job)->id, job->commandline);
+        }
+        return EXIT_SUCCESS;
+    }
+    for(i = 1; i < cmd->num_args; i++) {
+        if((strcmp(cmd->args[i], "-m") == 0 || strcmp(cmd->args[i], "-c") == 0) && cmd->args[i + 1]) {
+            limit = cmd->args[i][1] == 'm' ? &throttle->memory_limit : &throttle->cpu_limit;
+            value = strtod(cmd->args[++i], &end);
+            if(end == cmd->args[i] || *end || value < 0 || value > 100) {
+                error_message(ERR_INVALID_PERCENTAGE);
+                return EXIT_FAILURE;
+            }
+            *limit = value;                             /* zero turns the limit off */
+        } else if(strcmp(cmd->args[i], "-M") == 0 && cmd->args[i + 1]) {   /* another memory file */
+            snprintf(throttle->memory_path, sizeof(throttle->memory_path), "%s", cmd->args[++i]);
+        } else if(strcmp(cmd->args[i], "-C") == 0 && cmd->args[i + 1]) {   /* another cpu file */
+            snprintf(throttle->cpu_path, sizeof(throttle->cpu_path), "%s", cmd->args[++i]);
+        } else if(strcmp(cmd->args[i], "-i") == 0 && cmd->args[i + 1]) {   /* another interval */
+            error_code = parse_duration(cmd->args[++i], &value);
+            if(error_code != SSHELL_SUCCESS || value <= 0) {
+                error_message(ERR_INVALID_DURATION);
+                return EXIT_FAILURE;
+            }
+            throttle->interval = value;
+        } else {
+            error_message(SSHELL_ERR_INVALID_CMDLINE);
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+/*************************************************************
+ *                    OUTPUT                                 *
+ *************************************************************/
+
+/*
+ * This function initializes the rings: off, with the default sizes
+ * @param - {output *} - the rings
+ * @return - none
+ */
+void init_output(struct output *output) {
+    memset(output, 0, sizeof(struct output));
+    output->ring_size = RING_SIZE;
+    output->max_size = RING_TOTAL;
+    output->epoll_fd = -1;
+}
+
+/*
+ * This function gives the background job a pipe for its stdout and stderr, read into its
+ *  ring by the event loop of the shell
+ * @param - {shell *} - the shell
+ *        - {sshell_job *} - the job about to be spawned
+ * @return - {int} - zero on success, -1 if the job writes to the terminal
+ */
+int start_ring(struct shell *shell, struct sshell_job *job) {
+    struct output *output = &shell->output;
+    struct job_state *state = job_state(job);
+    struct epoll_event event;
+    int fds[2];
+
+    if(output->epoll_fd < 0) {                          /* readable through the epoll set of the shell */
+        output->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if(output->epoll_fd < 0) {
+            return -1;
+        }
+        event.events = EPOLLIN;
+        event.data.ptr = output;
+        epoll_ctl(shell->events_fd, EPOLL_CTL_ADD, output->epoll_fd, &event);
+    }
+    if(pipe2(fds, O_CLOEXEC) < 0) {
+        return -1;
+    }
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);                 /* a chatty job never blocks the shell */
+    event.events = EPOLLIN;
+    event.data.ptr = job;
+    if(epoll_ctl(output->epoll_fd, EPOLL_CTL_ADD, fds[0], &event) < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    state->output = output;
+    state->ring.fd = fds[0];
+    state->ring.write_fd = fds[1];
+    output->num_open++;
+    return 0;
+}
+
+/*
+ * This function closes the pipe of the ring, the bytes kept stay
+ * @param - {job_state *} - the state of the job
+ * @return - none
+ */
+void close_ring(struct job_state *state) {
+    if(state->ring.write_fd >= 0) {
+        close(state->ring.write_fd);
+        state->ring.write_fd = -1;
+    }
+    if(state->ring.fd < 0) {
+        return;
+    }
+    /* children forked without exec may still hold the pipe: leave the epoll set first */
+    epoll_ctl(state->output->epoll_fd, EPOLL_CTL_DEL, state->ring.fd, NULL);
+    close(state->ring.fd);
+    state->ring.fd = -1;
+    state->output->num_open--;
+}
+
+/*
+ * This function adds output to the ring. The ring grows from RING_MIN up to the ring size
+ *  while it never wrapped and the rings stay under the limit, then the oldest bytes are
+ *  overwritten
+ * @param - {output *} - the rings
+ *        - {ring *} - the ring
+ *        - {const char *} - the output
+ *        - {size_t} - number of bytes
+ * @return - none
+ */
+void append_ring(struct output *output, struct ring *ring, const char *data, size_t length) {
+    size_t size, end, first;
+    char *grown;
+
+    ring->total += length;
+    ring->unread = 1;
+    while(ring->start == 0 && ring->length + length > ring->capacity && ring->capacity < output->ring_size &&
+        output->used < output->max_size) {
+        size = ring->capacity ? 2 * ring->capacity : RING_MIN;
+        size = size < output->ring_size ? size : output->ring_size;
+        if(size - ring->capacity > output->max_size - output->used) {
+            size = ring->capacity + output->max_size - output->used;
+        }
+        grown = (char*) realloc(ring->data, size);      /* the bytes kept are at the start */
+        if(grown == NULL) {
+            break;
+        }
+        output->used += size - ring->capacity;
+        ring->data = grown;
+        ring->capacity = size;
+    }
+    if(ring->capacity == 0) {                           /* no memory left: the output is lost */
+        return;
+    }
+
+    if(length >= ring->capacity) {                      /* only the end fits */
+        data += length - ring->capacity;
+        length = ring->capacity;
+        ring->start = 0;
+        ring->length = 0;
+    }
+    end = (ring->start + ring->length) % ring->capacity;
+    first = ring->capacity - end < length ? ring->capacity - end : length;
+    memcpy(ring->data + end, data, first);
+    memcpy(ring->data, data + first, length - first);
+    ring->length += length;
+    if(ring->length > ring->capacity) {                 /* drop the oldest bytes */
+        ring->start = (ring->start + ring->length - ring->capacity) % ring->capacity;
+        ring->length = ring->capacity;
+    }
+}
+
+/*
+ * This function reads what the job wrote into its ring, at most RING_CHUNK bytes so that
+ *  one job cannot hold the shell, and closes the pipe once every writer is gone. A ring
+ *  that may still grow takes the space of the oldest finished jobs kept over the limit
+ * @param - {shell *} - the shell
+ *        - {sshell_job *} - the job
+ * @return - none
+ */
+void read_ring(struct shell *shell, struct sshell_job *job) {
+    static char buffer[RING_CHUNK];
+    struct output *output = &shell->output;
+    struct job_state *state = job_state(job);
+    ssize_t n;
+
+    if(state->ring.fd < 0) {
+        return;
+    }
+    n = read(state->ring.fd, buffer, sizeof(buffer));
+    if(n > 0) {
+        while(state->ring.start == 0 && state->ring.length + n > state->ring.capacity &&
+            state->ring.capacity < output->ring_size && output->used >= output->max_size &&
+            output->first_kept && output->first_kept != job) {
+            release_ring(shell, output->first_kept);
+        }
+        append_ring(state->output, &state->ring, buffer, n);
+    } else if(n == 0 || (errno != EAGAIN && errno != EINTR)) {
+        close_ring(state);
+    }
+}
+
+/*
+ * This function reads the pipes of the rings that are readable, without waiting
+ * @param - {shell *} - the shell
+ * @return - none
+ */
+void drain_rings(struct shell *shell) {
+    struct epoll_event events[MAX_EVENTS];
+    int i, n = epoll_wait(shell->output.epoll_fd, events, MAX_EVENTS, 0);
+
+    for(i = 0; i < n; i++) {
+        read_ring(shell, (struct sshell_job *) events[i].data.ptr);
+    }
+}
+
+/*
+ * This function writes the tail of the output of the job to stdout, and how much of the
+ *  output was dropped to stderr
+ * @param - {shell *} - the shell
+ *        - {sshell_job *} - the job
+ * @return - none
+ */
+void dump_ring(struct shell *shell, struct sshell_job *job) {
+    struct ring *ring = &job_state(job)->ring;
+    size_t first;
+
+    read_ring(shell, job);                              /* what the job just wrote */
+    ring->unread = 0;
+    if(ring->total > (long long) ring->length) {
+        fprintf(stderr, "+ %lld bytes dropped\n", ring->total - (long long) ring->length);
+    }
+    if(ring->length == 0) {
+        return;
+    }
+    first = ring->capacity - ring->start < ring->length ? ring->capacity - ring->start : ring->length;
+    fwrite(ring->data + ring->start, 1, first, stdout);
+    fwrite(ring->data, 1, ring->length - first, stdout);
+    fflush(stdout);
+}
+
+/*
+ * This function keeps the finished job, with its id and its ring, until its tail is read
+ *  or a later job needs the space
+ * @param - {job_list *} - the job list the job was taken out of
+ *        - {sshell_job *} - the finished job
+ * @return - none
+ */
+void keep_ring(struct job_list *job_list, struct sshell_job *job) {
+    struct sshell_job **link = &job_state(job)->output->first_kept;
+
+    if(job_list->current == job) {                      /* nothing to bring back */
+        job_list->current = NULL;
+    }
+    disarm_timer(job);                                  /* it never fires for a finished job */
+    job_state(job)->ring.kept = 1;
+    while(*link) {
+        link = &((*link)->next_job);
+    }
+    *link = job;
+}
+
+/*
+ * This function frees the finished job kept for its ring, and its id
+ * @param - {shell *} - the shell
+ *        - {sshell_job *} - the kept job
+ * @return - none
+ */
+void release_ring(struct shell *shell, struct sshell_job *job) {
+    unlink_job(&shell->output.first_kept, job);
+    remove_job_id(shell->job_list, job);
+    free_job(job);
+}
+
+/*
+ * This function prints out the rings of the jobs, changes them, or writes out the tail of
+ *  the %n jobs: output [on|off] [-s SIZE] [-m SIZE] [%n...]
+ * @param - {shell *} - the shell
+ *        - {sshell_job *} - the job running the builtin
+ *        - {sshell_command *} - the output command
+ * @return - {int} - return success or failure status
+ */
+int builtin_output(struct shell *shell, struct sshell_job *self, struct sshell_command *cmd) {
+    struct output *output = &shell->output;
+    struct sshell_job *job;
+    struct job_state *state;
+    long long size;
+    int i, id, error_code;
+
+    if(output->epoll_fd >= 0) {                         /* what the jobs wrote since the last prompt */
+        drain_rings(shell);
+    }
+    if(cmd->args[1] == NULL) {
+        printf("output %s: ring %zu bytes, %zu of %zu bytes used\n", output->enabled ? "on" : "off",
+            output->ring_size, output->used, output->max_size);
+        for(job = shell->job_list->first_job; job; job = job->next_job) {
+            state = job_state(job);
+            if(state->output) {
+                printf("[%d] '%s': %zu of %lld bytes kept%s\n", state->id, job->commandline,
+                    state->ring.length, state->ring.total, state->ring.fd >= 0 ? "" : ", closed");
+            }
+        }
+        for(job = output->first_kept; job; job = job->next_job) {
+            state = job_state(job);
+            printf("[%d] '%s': %zu of %lld bytes kept, finished\n", state->id, job->commandline,
+                state->ring.length, state->ring.total);
+        }
+        return EXIT_SUCCESS;
+    }
+    for(i = 1; i < cmd->num_args; i++) {
+        if(strcmp(cmd->args[i], "on") == 0 || strcmp(cmd->args[i], "off") == 0) {
+            output->enabled = cmd->args[i][1] == 'n';   /* for the jobs started from now on */
+        } else if((strcmp(cmd->args[i], "-s") == 0 || strcmp(cmd->args[i], "-m") == 0) && cmd->args[i + 1]) {
+            error_code = parse_size(cmd->args[i + 1], &size);
+            if(error_code != SSHELL_SUCCESS || size <= 0) {
+                error_message(ERR_INVALID_SIZE);
+                return EXIT_FAILURE;
+            }
+            if(cmd->args[i][1] == 's') {                /* the rings grown past it keep their bytes */
+                output->ring_size = size;
+            } else {
+                output->max_size = size;
+            }
+            i++;
+        } else if(cmd->args[i][0] == '%') {             /* the tail of a job */
+            job = find_job(shell->job_list, cmd->args[i], self);
+            id = atoi(cmd->args[i] + 1);
+            if(job == NULL && id > 0 && id < MAX_JOBS && shell->job_list->table[id] &&
+                job_state(shell->job_list->table[id])->ring.kept) {     /* a finished job */
+                job = shell->job_list->table[id];
+            }
+            if(job == NULL) {
+                error_message(ERR_NO_SUCH_JOB);
+                return EXIT_FAILURE;
+            }
+            if(job_state(job)->output == NULL) {
+                error_message(ERR_NOT_CAPTURED);
+                return EXIT_FAILURE;
+            }
+            dump_ring(shell, job);
+            if(job_state(job)->ring.kept) {             /* its tail was all that was left */
+                release_ring(shell, job);
+            }
+        } else {
+            error_message(SSHELL_ERR_INVALID_CMDLINE);
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+/*************************************************************
+ *                    SERVER                                 *
+ *************************************************************/
+
+/*
+ * This function runs the shell as a server: it reads requests `TAG [-o] COMMANDLINE` on the
+ *  connections to the Unix socket and runs up to max_jobs of them at once. A request gets
+ *  `TAG out LENGTH` and the bytes of its output if asked with -o, then `TAG exit STATUS...`
+ *  with the status of each command, or `TAG fail MESSAGE` if it was not run
+ * @param - {shell *} - the shell of the builtin commands
+ *        - {const char *} - the path of the socket
+ *        - {int} - number of jobs running at once
+ * @return - {int} - exit status of the server
+ */
+int serve(struct shell *shell, const char *path, int max_jobs) {
+    struct server server;
+    struct sockaddr_un address;
+    struct epoll_event event, events[MAX_EVENTS];
+    struct signalfd_siginfo info;
+    struct source *source;
+    struct client *client;
+    struct stat file;
+    sigset_t mask;
+    int i, n;
+
+    memset(&server, 0, sizeof(server));
+    memset(&address, 0, sizeof(address));
+    if(strlen(path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Error: socket path too long\n");
+        return EXIT_FAILURE;
+    }
+    server.shell = shell;
+    server.max_jobs = max_jobs;
+    server.path = path;
+
+    /* the signals are read from the epoll set, the children get the old mask back */
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGINT);
+    sigprocmask(SIG_BLOCK, &mask, &shell->signal_mask);
+
+    /* listen on the socket, replacing the socket of a previous server */
+    if(lstat(path, &file) == 0 && S_ISSOCK(file.st_mode)) {
+        unlink(path);
+    }
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+    server.listen.type = SOURCE_LISTEN;
+    server.listen.fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(server.listen.fd < 0 || bind(server.listen.fd, (struct sockaddr*) &address, sizeof(address)) < 0 ||
+        listen(server.listen.fd, SOMAXCONN) < 0) {
+        perror(path);
+        return EXIT_FAILURE;
+    }
+
+    server.signal.type = SOURCE_SIGNAL;
+    server.signal.fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    server.events_fd = epoll_create1(EPOLL_CLOEXEC);
+    event.events = EPOLLIN;
+    event.data.ptr = &server.listen;
+    epoll_ctl(server.events_fd, EPOLL_CTL_ADD, server.listen.fd, &event);
+    event.data.ptr = &server.signal;
+    epoll_ctl(server.events_fd, EPOLL_CTL_ADD, server.signal.fd, &event);
+
+    while(!server.stopping || server.running > 0) {
+        n = epoll_wait(server.events_fd, events, MAX_EVENTS, -1);
+        for(i = 0; i < n; i++) {
+            source = (struct source*) events[i].data.ptr;
+            switch(source->type) {
+                case SOURCE_LISTEN:                         /* new connections */
+                    accept_clients(&server);
+                    break;
+                case SOURCE_SIGNAL:                         /* children changed state, or asked to stop */
+                    while(read(server.signal.fd, &info, sizeof(info)) > 0) {
+                        if(info.ssi_signo != SIGCHLD && !server.stopping) {
+                            stop_server(&server);
+                        }
+                    }
+                    reap_requests(&server);
+                    break;
+                case SOURCE_CLIENT:                         /* requests, or room for the replies */
+                    client = (struct client*) source;
+                    if(events[i].events & EPOLLIN) {
+                        read_requests(&server, client);
+                    } else if(events[i].events & (EPOLLHUP | EPOLLERR)) {
+                        client->dead = 1;
+                    }
+                    update_client(&server, client);
+                    break;
+                case SOURCE_CAPTURE:                        /* output of a job */
+                    read_capture(&server, (struct request*) source);
+                    break;
+            }
+        }
+        start_requests(&server);
+        close_clients(&server, 0);
+    }
+
+    close_clients(&server, 1);
+    close(server.signal.fd);
+    close(server.events_fd);
+    return EXIT_SUCCESS;
+}
+
+/*
+ * This function accepts the waiting connections
+ * @param - {server *} - the server
  * @return - none
  */
-void error_message(int error_code) {
-    switch(error_code) {
-        case(ERR_INVALID_CMDLINE):
-            fprintf(stderr, "Error: invalid command line\n");
-            break;
-        case(ERR_CMD_NOTFOUND):
-            fprintf(stderr, "Error: command not found\n");
-            break;
-        case(ERR_DIR_NOTFOUND):
-            fprintf(stderr, "Error: no such directory\n");
-            break;
-        case(ERR_OPEN_INPUTFILE):
-            fprintf(stderr, "Error: cannot open input file\n");
-            break;
-        case(ERR_OPEN_OUTPUTFILE):
-            fprintf(stderr, "Error: cannot open output file\n");
-            break;
-        case(ERR_NO_INPUTFILE):
-            fprintf(stderr, "Error: no input file\n");
-            break;
-        case(ERR_NO_OUTPUTFILE):
-            fprintf(stderr, "Error: no output file\n");
-            break;
-        case(ERR_INPUT_MISLOCATED):
-            fprintf(stderr, "Error: mislocated input redirection\n");
-            break;
-        case(ERR_OUTPUT_MISLOCATED):
-            fprintf(stderr, "Error: mislocated output redirection\n");
-            break;
-        case(ERR_BACKGROUND_MISLOCATED):
-            fprintf(stderr, "Error: mislocated background sign\n");
+void accept_clients(struct server *server) {
+    struct epoll_event event;
+    struct client *client;
+    int fd;
+
+    while((fd = accept4(server->listen.fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        client = (struct client*) calloc(1, sizeof(struct client));
+        client->socket.type = SOURCE_CLIENT;
+        client->socket.fd = fd;
+        client->next_client = server->first_client;
+        server->first_client = client;
+
+        event.events = EPOLLIN;
+        event.data.ptr = &client->socket;
+        epoll_ctl(server->events_fd, EPOLL_CTL_ADD, fd, &event);
+    }
+}
+
+/*
+ * This function reads the requests of the client until it has SERVE_PENDING of them:
+ *  the socket is not read further, so a client sending too fast blocks in its writes
+ * @param - {server *} - the server
+ *        - {client *} - the client
+ * @return - none
+ */
+void read_requests(struct server *server, struct client *client) {
+    ssize_t n;
+
+    queue_lines(server, client);
+    while(client->pending < SERVE_PENDING && !client->eof && !client->dead) {
+        n = read(client->socket.fd, client->input + client->input_len,
+            sizeof(client->input) - 1 - client->input_len);
+        if(n < 0 && errno == EINTR) {
+            continue;
+        }
+        if(n < 0 && errno == EAGAIN) {
             break;
-        case(ERR_ACTIVE_JOBS):
-            fprintf(stderr, "Error: active jobs still running\n");
+        }
+        if(n <= 0) {                                        /* end of file, or the connection broke */
+            client->eof = 1;
+            client->dead = n < 0;
             break;
+        }
+        client->input_len += n;
+        if(client->discarding) {
+            discard_line(client);
+        }
+        queue_lines(server, client);
+
+        if(client->input_len == sizeof(client->input) - 1) {   /* no end in sight: too long for a command line */
+            reject_line(client);
+        }
     }
 }
 
 /*
- * This function prints out any completed process info
- * @param - {job *} - the job list
+ * This function fails the request line too long for the input of the client, once, with
+ *  its tag, and drops the rest of it as it comes
+ * @param - {client *} - the client
  * @return - none
  */
-void process_complete_message(struct job **first_job) {
-    /* Information message after execution */
-    int i;
-    struct job *job_node = *first_job;
-    while(job_node) {
-        if(job_node->finish) {              /* print message for all completed processes */
-            fprintf(stderr, "+ completed '%s' ", job_node->commandline);
-            struct command *cmd_node = job_node->first_command;
-            for(i = 0; i < job_node->num_processes; i++) {
-                fprintf(stderr, "[%d]", WEXITSTATUS(cmd_node->status));
-                cmd_node = cmd_node->next_command;
-            }
-            fprintf(stderr, "\n");
-            struct job *copy = job_node;    /* copy it for deletion */
-            job_node = job_node->next_job;  /* go to the next job */
-            delete_job(first_job, copy);    /* delete the job if it is finished */
+void reject_line(struct client *client) {
+    char message[MAX_TAG + 64];
+    const char *tag = "-";
+    int start, length;
+
+    /* the tag, if the line is not one word */
+    for(start = 0; client->input[start] == ' ' || client->input[start] == '\t'; start++);
+    for(length = 0; start + length < client->input_len && client->input[start + length] != ' ' &&
+        client->input[start + length] != '\t'; length++);
+    if(start + length < client->input_len && length > 0) {
+        tag = client->input + start;
+    } else {
+        length = 1;
+    }
+    length = snprintf(message, sizeof(message), "%.*s fail command line too long\n",
+        length < MAX_TAG ? length : MAX_TAG - 1, tag);
+    reply(client, message, length);
+
+    client->input_len = 0;
+    client->discarding = 1;
+}
+
+/*
+ * This function drops the input of the client up to the end of the rejected line
+ * @param - {client *} - the client
+ * @return - none
+ */
+void discard_line(struct client *client) {
+    char *end = memchr(client->input, '\n', client->input_len);
+
+    if(end == NULL) {                                       /* the line goes on */
+        client->input_len = 0;
+        return;
+    }
+    client->discarding = 0;
+    client->input_len -= end + 1 - client->input;
+    memmove(client->input, end + 1, client->input_len);
+}
+
+/*
+ * This function queues the complete request lines the client sent while it has room for them
+ * @param - {server *} - the server
+ *        - {client *} - the client
+ * @return - none
+ */
+void queue_lines(struct server *server, struct client *client) {
+    char *line = client->input, *end;
+
+    while(client->pending < SERVE_PENDING &&
+        (end = memchr(line, '\n', client->input + client->input_len - line))) {
+        *end = 0;
+        queue_request(server, client, line);
+        line = end + 1;
+    }
+    client->input_len -= line - client->input;
+    memmove(client->input, line, client->input_len);
+}
+
+/*
+ * This function reads the request line `TAG [-o] COMMANDLINE` and queues the request
+ * @param - {server *} - the server
+ *        - {client *} - the client sending it
+ *        - {char *} - the request line
+ * @return - none
+ */
+void queue_request(struct server *server, struct client *client, char *line) {
+    struct request *request;
+    int length;
+
+    for(; *line == ' ' || *line == '\t'; line++);          /* get rid of leading spaces and tabs */
+    if(*line == 0) {                                        /* an empty line is no request */
+        return;
+    }
+
+    request = (struct request*) calloc(1, sizeof(struct request));
+    request->capture.type = SOURCE_CAPTURE;
+    request->capture.fd = -1;
+    request->capture_out = -1;
+    request->client = client;
+    request->server = server;
+    client->pending++;
+
+    /* the tag */
+    for(length = 0; line[length] && line[length] != ' ' && line[length] != '\t'; length++);
+    snprintf(request->tag, sizeof(request->tag), "%.*s", length, line);
+    for(line += length; *line == ' ' || *line == '\t'; line++);
+
+    /* the output is sent back with -o */
+    if(line[0] == '-' && line[1] == 'o' && (line[2] == ' ' || line[2] == '\t' || line[2] == 0)) {
+        request->captured = 1;
+        line += 2;
+    }
+    strncpy(request->line, line, MAX_CMD - 1);
+
+    if(server->stopping) {
+        finish_request(server, request, "server stopping");
+    } else if(server->last_queued) {
+        server->last_queued->next_request = request;
+        server->last_queued = request;
+    } else {
+        server->first_queued = server->last_queued = request;
+    }
+}
+
+/*
+ * This function starts the queued requests while fewer than max_jobs jobs run
+ * @param - {server *} - the server
+ * @return - none
+ */
+void start_requests(struct server *server) {
+    struct request *request;
+
+    while(server->running < server->max_jobs && server->first_queued) {
+        request = server->first_queued;
+        server->first_queued = request->next_request;
+        if(server->first_queued == NULL) {
+            server->last_queued = NULL;
+        }
+        request->next_request = NULL;
+        if(request->client->dead) {                         /* nobody waits for it */
+            finish_request(server, request, "client gone");
         } else {
-            job_node = job_node->next_job;  /* go to the next job */
+            start_request(server, request);
         }
     }
 }
 
-/*************************************************************
- *                       MAIN FUNCTION                       *
- *************************************************************/
+/*
+ * This function parses, checks and spawns the job of the request
+ * @param - {server *} - the server
+ *        - {request *} - the request
+ * @return - none
+ */
+void start_request(struct server *server, struct request *request) {
+    struct sshell_hooks hooks = {request, serve_in_caller, serve_in_child, serve_run_in_child, NULL};
+    struct sshell_command *cmd;
+    const struct builtin *builtin;
+    struct epoll_event event;
+    char message[MAX_CMD];
+    int fds[2], length, error_code;
+
+    request->job = sshell_parse(request->line, NULL);
+    error_code = request->job ? sshell_validate(request->job, 1) : SSHELL_FAILURE;
+    for(cmd = request->job ? request->job->first_command : NULL; cmd && error_code == SSHELL_SUCCESS;
+        cmd = cmd->next_command) {
+        builtin = find_builtin(server->shell, cmd->args[0]);
+        if(builtin && builtin->flag == BUILTIN_SHELL) {     /* nothing may change the server */
+            error_code = SSHELL_ERR_INVALID_CMDLINE;
+        }
+    }
+    if(error_code == SSHELL_SUCCESS && request->captured && pipe2(fds, O_CLOEXEC) < 0) {
+        error_code = SSHELL_ERR_FORK;
+    }
+    if(error_code != SSHELL_SUCCESS) {
+        if(request->job) {
+            sshell_free_job(request->job);
+            request->job = NULL;
+        }
+        finish_request(server, request, sshell_strerror(error_code));
+        return;
+    }
+
+    /* run the job, its last command writes to the pipe of the captured output */
+    if(request->captured) {
+        request->capture.fd = fds[0];
+        request->capture_out = fds[1];
+    }
+    sshell_spawn(request->job, &hooks);
+    if(request->captured) {
+        close(request->capture_out);
+        request->capture_out = -1;
+    }
+    request->next_request = server->first_running;
+    server->first_running = request;
+    server->running++;
+
+    /* the errors of the children before exec belong to the output */
+    for(cmd = request->job->first_command; cmd; cmd = cmd->next_command) {
+        if(cmd->error != SSHELL_SUCCESS && request->captured) {
+            length = snprintf(message, sizeof(message), "Error: %s\n", sshell_strerror(cmd->error));
+            reply_output(request, message, length);
+        } else if(cmd->error != SSHELL_SUCCESS) {
+            error_message(cmd->error);
+        }
+    }
+
+    if(request->captured) {
+        event.events = EPOLLIN;
+        event.data.ptr = &request->capture;
+        epoll_ctl(server->events_fd, EPOLL_CTL_ADD, request->capture.fd, &event);
+    } else if(sshell_check_finish(request->job) == SSHELL_FINISHED) {   /* no command was started */
+        finish_request(server, request, NULL);
+        return;
+    }
+    update_client(server, request->client);
+}
 
 /*
- * main function of the sshell
+ * This function runs the builtin commands of a request in the child without exec
+ * @param - {void *} - the request
+ *        - {sshell_job *} - the job of the command
+ *        - {sshell_command *} - the command
+ * @return - {int} - hook code
  */
-int main(int argc, char *argv[]) {  
+int serve_in_caller(void *data, struct sshell_job *job, struct sshell_command *cmd) {
+    struct request *request = (struct request*) data;
+    return find_builtin(request->server->shell, cmd->args[0]) ? SSHELL_FORK : SSHELL_SPAWN;
+}
+
+/*
+ * This function gives the child of a request /dev/null for input, the pipe of the captured
+ *  output for output and error, and the signal mask of the server before it started
+ * @param - {void *} - the request
+ *        - {sshell_job *} - the job of the child
+ *        - {sshell_command *} - the command of the child
+ * @return - none
+ */
+void serve_in_child(void *data, struct sshell_job *job, struct sshell_command *cmd) {
+    struct request *request = (struct request*) data;
+    int fd = open("/dev/null", O_RDONLY);
+
+    if(fd >= 0) {                                           /* the requests read their files only */
+        dup2(fd, STDIN_FILENO);
+        close(fd);
+    }
+    if(request->capture_out >= 0) {
+        dup2(request->capture_out, STDOUT_FILENO);
+        dup2(request->capture_out, STDERR_FILENO);
+        close(request->capture_out);
+    }
+    sigprocmask(SIG_SETMASK, &request->server->shell->signal_mask, NULL);
+}
+
+/*
+ * This function runs a builtin command of a request in its child, after its redirections
+ * @param - {void *} - the request
+ *        - {sshell_job *} - the job of the command
+ *        - {sshell_command *} - the builtin command
+ * @return - {int} - exit status of the builtin
+ */
+int serve_run_in_child(void *data, struct sshell_job *job, struct sshell_command *cmd) {
+    struct shell *shell = ((struct request*) data)->server->shell;
+    return find_builtin(shell, cmd->args[0])->run(shell, job, cmd);
+}
+
+/*
+ * This function sends what the job of the request wrote to the client. The fds leave the
+ *  epoll set before they are closed: a builtin child without exec may still hold them
+ * @param - {server *} - the server
+ *        - {request *} - the request
+ * @return - none
+ */
+void read_capture(struct server *server, struct request *request) {
+    char buffer[SERVE_CHUNK];
+    ssize_t n = read(request->capture.fd, buffer, sizeof(buffer));
+
+    if(n < 0 && (errno == EINTR || errno == EAGAIN)) {
+        return;
+    }
+    if(n <= 0) {                                            /* every command closed its output */
+        epoll_ctl(server->events_fd, EPOLL_CTL_DEL, request->capture.fd, NULL);
+        close(request->capture.fd);
+        request->capture.fd = -1;
+        if(sshell_check_finish(request->job) == SSHELL_FINISHED) {
+            finish_request(server, request, NULL);
+        }
+        return;
+    }
+    reply_output(request, buffer, n);
+    update_client(server, request->client);
+}
+
+/*
+ * This function reaps the children of the server and finishes the requests whose jobs are done
+ * @param - {server *} - the server
+ * @return - none
+ */
+void reap_requests(struct server *server) {
+    struct request *request;
     pid_t pid;
     int status;
-    struct command *cmd;
-    struct job_list *job_list = (struct job_list*) malloc(sizeof(struct job_list));
-    job_list->first_job = NULL;                             /* initialize first job to NULL */
 
-    while(1) {
-        int fd[2];
-        int builtin_command_code, error_code;
-        struct job *job;
-        printf("sshell$ ");                                 /* Display prompt */
-    
-        job = read_job();                                   /* read the job */
-        cmd = job->first_command;                           /* initializes first command */
-    
-        /* no command is entered */
-        if(is_empty_command(job->commandline)) {
-            /* check background processes to see if they are completed */
-            check_background_process(job_list->first_job, NULL);
-
-            /* print out completed process message */
-            process_complete_message(&(job_list->first_job));
-        
-            /* clear out allocated space for current job(which is empty) */
-            free_job(job);
-            continue;
-        } 
+    while((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        for(request = server->first_running; request; request = request->next_request) {
+            if(sshell_record(request->job, pid, status)) {
+                if(request->job->finish == SSHELL_FINISHED && request->capture.fd < 0) {
+                    finish_request(server, request, NULL);
+                }
+                break;
+            }
+        }
+    }
+}
 
-        /* check if input/output redirection has errors */
-        error_code = check_job(job);
-        if(error_code != SUCCESS) {
-            /* prints out error message */
-            error_message(error_code);
+/*
+ * This function sends the last reply of the request and frees it
+ * @param - {server *} - the server
+ *        - {request *} - the request, running if it has a job
+ *        - {const char *} - why the request was not run, NULL if it ran
+ * @return - none
+ */
+void finish_request(struct server *server, struct request *request, const char *failure) {
+    struct client *client = request->client;
+    struct request **link;
+    struct sshell_command *cmd;
+    char message[MAX_TAG + 4 * MAX_CMD];
+    int length, status;
+
+    if(request->job) {
+        /* leave the running list */
+        for(link = &(server->first_running); *link != request; link = &((*link)->next_request));
+        *link = request->next_request;
+        server->running--;
+
+        length = snprintf(message, sizeof(message), "%s exit", request->tag);
+        for(cmd = request->job->first_command; cmd; cmd = cmd->next_command) {
+            status = sshell_exit_status(cmd->status);
+            length += snprintf(message + length, sizeof(message) - length, " %d", status);
+        }
+        length += snprintf(message + length, sizeof(message) - length, "\n");
+        sshell_free_job(request->job);
+    } else {
+        length = snprintf(message, sizeof(message), "%s fail %s\n", request->tag, failure);
+    }
+    reply(client, message, length);
+    free(request);
+
+    /* the client has room for another request */
+    client->pending--;
+    queue_lines(server, client);
+    update_client(server, client);
+}
+
+/*
+ * This function stops the server: no more connections or requests, the queued requests fail
+ *  and the running jobs are terminated, the server leaves once they are reaped
+ * @param - {server *} - the server
+ * @return - none
+ */
+void stop_server(struct server *server) {
+    struct request *request;
+    struct client *client;
+
+    server->stopping = 1;
+    epoll_ctl(server->events_fd, EPOLL_CTL_DEL, server->listen.fd, NULL);
+    close(server->listen.fd);
+    unlink(server->path);
+
+    while((request = server->first_queued)) {
+        server->first_queued = request->next_request;
+        finish_request(server, request, "server stopping");
+    }
+    server->last_queued = NULL;
+    for(request = server->first_running; request; request = request->next_request) {
+        if(request->job->pgid) {
+            sshell_signal(request->job, SIGTERM);
+        }
+    }
+    for(client = server->first_client; client; client = client->next_client) {
+        update_client(server, client);
+    }
+}
+
+/*
+ * This function adds a reply to the replies waiting for the client
+ * @param - {client *} - the client
+ *        - {const char *} - the reply
+ *        - {size_t} - length of the reply
+ * @return - none
+ */
+void reply(struct client *client, const char *data, size_t length) {
+    if(client->dead) {                                      /* nobody to reply to */
+        return;
+    }
+    if(client->output_len + length > client->output_size) {
+        client->output_size = 2 * (client->output_len + length);
+        client->output = (char*) realloc(client->output, client->output_size);
+    }
+    memcpy(client->output + client->output_len, data, length);
+    client->output_len += length;
+}
+
+/*
+ * This function adds a chunk of the output of the request to the replies of its client
+ * @param - {request *} - the request
+ *        - {const char *} - the output
+ *        - {size_t} - length of the output
+ * @return - none
+ */
+void reply_output(struct request *request, const char *data, size_t length) {
+    char header[MAX_TAG + 32];
+    int n = snprintf(header, sizeof(header), "%s out %zu\n", request->tag, length);
+
+    reply(request->client, header, n);
+    reply(request->client, data, length);
+}
+
+/*
+ * This function sends what the socket takes of the replies, then sets what the server waits
+ *  for: requests while the client has room for them, room in the socket while replies wait,
+ *  and the output of its jobs while fewer than SERVE_OUTBOX bytes wait. A job writing faster
+ *  than its client reads blocks on the full pipe of its output
+ * @param - {server *} - the server
+ *        - {client *} - the client
+ * @return - none
+ */
+void update_client(struct server *server, struct client *client) {
+    struct epoll_event event;
+    struct request *request;
+    ssize_t n;
+    int paused;
 
-            /* clear out allocated space for current job */
-            free_job(job);
+    /* send the replies */
+    while(!client->dead && client->output_len > 0) {
+        n = send(client->socket.fd, client->output, client->output_len, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if(n < 0 && errno == EINTR) {
             continue;
         }
-    
-        insert_job(&(job_list->first_job), job);            /* insert the job to the job list */
-    
-        builtin_command_code = is_builtin_command(cmd);
-        if(builtin_command_code == EXIT) {                  /* run exit */
-            if(job_list->first_job->next_job != NULL) {     /* try to exit while there are active jobs */
-                status = EXIT_FAILURE;
-                error_message(ERR_ACTIVE_JOBS);
-            } else {                                        /* can exit */
-                fprintf(stderr, "Bye...\n");
-                free_job_list(job_list);
-                break;
-            }
+        if(n < 0 && errno == EAGAIN) {
+            break;
         }
-        else if(builtin_command_code == CD) {              /* run cd comamnd */
-            status = cd(cmd->args[1]);
-            if(job->num_processes == 1) {
-                cmd->background = 0;
-            }
-        } else if(builtin_command_code == PWD) {           /* run pwd command */
-            status = pwd(); 
-            if(job->num_processes == 1) {
-                cmd->background = 0;
-            }
+        if(n <= 0) {                                        /* the connection broke */
+            client->dead = 1;
+            break;
         }
-         
-        if(cmd->next_command) {                            /* pipelineing */
-            pipe(fd);
-        }  
-    
-        /* run not-built-in command */
-        pid = fork();                                      /* fork child process */
-        cmd->pid = pid;                                    /* save pid */
-        if(pid == 0) {                                     /* child */
-            if(cmd->next_command) {                        /* pipelineing */
-                close(fd[0]);                              /* close out unnessary files */
-            }
-
-            if(builtin_command_code == NOT_BUILTIN) {      /* not builtin command */
-                if(cmd->next_command) {                    /* pipelineing */
-                    dup2(fd[1], STDOUT_FILENO);            /* close out unnessary files */
-                    close(fd[1]);
-                }   
-
-                /* perform redirections */
-                redirection(cmd);
-            
-                execvp(cmd->args[0], cmd->args);        
-                /* execvp error */
-                error_message(ERR_CMD_NOTFOUND);
-                exit(EXIT_FAILURE);
-            } else {                                       /* builtin command */
-                /* perform redirections */
-                redirection(cmd);
+        memmove(client->output, client->output + n, client->output_len - n);
+        client->output_len -= n;
+    }
 
-                if(cmd->next_command) {                    /* pipelineing */
-                    close(fd[1]);                          /* close out unnessary files */
-                }
-                exit(status);
-            }
-        } else if(pid > 0) {                               /* parent */
-            struct command *last_command = find_last_command(cmd);
-            if(cmd->next_command) {                                      /* pipelineing */
-                close(fd[1]);                                            /* close out unnessary files */
-                pipeline(cmd->next_command, fd, job_list);               /* pipeline the commands */
-            }    
-
-            /* waiting */
-            if(last_command->background == 0) {
-                /* wait for any child processes */
-                while(job->finish != FINISHED) {
-                    pid = wait(&status);                                 /* wait for any child process */
-                    insert_status(job_list->first_job, pid, status);     /* store the exit status */
-                    job->finish = check_finish_job(job);
+    if(client->dead) {
+        client->output_len = 0;
+        if(client->socket.fd >= 0) {
+            epoll_ctl(server->events_fd, EPOLL_CTL_DEL, client->socket.fd, NULL);
+            close(client->socket.fd);
+            client->socket.fd = -1;
+            for(request = server->first_running; request; request = request->next_request) {
+                if(request->client == client && request->job->pgid) {   /* nobody waits for them */
+                    sshell_signal(request->job, SIGTERM);
                 }
             }
+        }
+    } else {
+        event.events = (client->output_len > 0 ? EPOLLOUT : 0) |
+            (!client->eof && !server->stopping && client->pending < SERVE_PENDING ? EPOLLIN : 0);
+        event.data.ptr = &client->socket;
+        epoll_ctl(server->events_fd, EPOLL_CTL_MOD, client->socket.fd, &event);
+    }
+
+    /* stop reading the output of the jobs of a slow client */
+    paused = client->output_len >= SERVE_OUTBOX;
+    for(request = server->first_running; request; request = request->next_request) {
+        if(request->client == client && request->capture.fd >= 0 && request->paused != paused) {
+            request->paused = paused;
+            event.events = EPOLLIN;
+            event.data.ptr = &request->capture;
+            epoll_ctl(server->events_fd, paused ? EPOLL_CTL_DEL : EPOLL_CTL_ADD, request->capture.fd, &event);
+        }
+    }
+}
+
+/*
+ * This function frees the clients with nothing left to do
+ * @param - {server *} - the server
+ *        - {int} - one to free every client
+ * @return - none
+ */
+void close_clients(struct server *server, int all) {
+    struct client **link = &(server->first_client);
+    struct client *client;
+
+    while((client = *link)) {
+        if(all || (client->pending == 0 && (client->dead || (client->eof && client->output_len == 0)))) {
+            *link = client->next_client;
+            if(client->socket.fd >= 0) {
+                epoll_ctl(server->events_fd, EPOLL_CTL_DEL, client->socket.fd, NULL);
+                close(client->socket.fd);
+            }
+            free(client->output);
+            free(client);
+        } else {
+            link = &(client->next_client);
+        }
+    }
+}
+
+/*************************************************************
+ *                       MAIN FUNCTION                       *
+ *************************************************************/
+
+/*
+ * main function of the sshell
+ */
+int main(int argc, char *argv[]) {  
+    char line[MAX_CMD];
+    struct shell shell;
+    struct node *tree;
+    struct function *function;
+    int max_jobs = 0, status;
 
-            /* check background processes to see if they are completed */
-            check_background_process(job_list->first_job, job);
+    shell.job_list = (struct job_list*) calloc(1, sizeof(struct job_list));   /* no jobs, no ids */
+    shell.first_function = NULL;
+    shell.first_tree = NULL;
+    shell.positional = NULL;
+    shell.num_positional = 0;
+    shell.last_status = EXIT_SUCCESS;
+    shell.exiting = 0;
+    shell.in_list = 0;
+    shell.meter = 0;
+    shell.background_timeout = 0;
+    init_cache(&shell.cache);
+    init_throttle(&shell.throttle);
+    init_output(&shell.output);
 
-            /* print out completed process message */
-            process_complete_message(&(job_list->first_job));
-        } else {                /* fork error */ 
-            perror("fork"); 
-            exit(EXIT_FAILURE);
+    /* daemon mode: requests over a socket, no prompt and no terminal */
+    if(argc > 1 && strcmp(argv[1], "--serve") == 0) {
+        if(argc == 3) {
+            max_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+        } else if(argc == 5 && strcmp(argv[3], "-j") == 0) {
+            max_jobs = atoi(argv[4]);
         }
+        if(max_jobs < 1) {
+            fprintf(stderr, "Usage: sshell [--serve SOCKET [-j MAX_JOBS]]\n");
+            return EXIT_FAILURE;
+        }
+        init_builtins(&shell);
+        status = serve(&shell, argv[2], max_jobs);
+        free_builtins(&shell);
+        free(shell.job_list);
+        return status;
+    }
+
+    init_job_control(&shell);
+    init_events(&shell);
+    init_builtins(&shell);
+
+    while(!shell.exiting) {
+        printf("sshell$ ");                                 /* Display prompt */
+        read_line(&shell, line);                            /* read the command line */
+        run_line(&shell, line);                             /* parse and run it */
+    }
+
+    /* free the functions and their trees */
+    while(shell.first_function) {
+        function = shell.first_function;
+        shell.first_function = function->next_function;
+        free(function);
+    }
+    while(shell.first_tree) {
+        tree = shell.first_tree;
+        shell.first_tree = tree->next_tree;
+        free_node(tree);
     }
+    free_builtins(&shell);
+    close(shell.signal_fd);
+    close(shell.events_fd);
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,166 @@
+#ifndef SSHELL_H
+#define SSHELL_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*************************************************************
+ *                    MACRO DEFINITIONS                      *
+ *************************************************************/
+
+#define SSHELL_MAX_CMD 512
+#define SSHELL_MAX_ARGS 16
+#define SSHELL_MAX_SUBST 8
+#define SSHELL_MAX_BRANCHES 8
+
+/*************************************************************
+ *                    STRUCT and ENUM DEFINITIONS            *
+ *************************************************************/
+
+/* finish code */
+enum {
+    SSHELL_NOT_FINISHED,
+    SSHELL_FINISHED
+};
+
+/* error code, sshell_strerror() gives the message */
+enum {
+    SSHELL_SUCCESS,
+    SSHELL_FAILURE,
+    SSHELL_ERR_INVALID_CMDLINE,
+    SSHELL_ERR_CMD_NOTFOUND,
+    SSHELL_ERR_OPEN_INPUTFILE,
+    SSHELL_ERR_OPEN_OUTPUTFILE,
+    SSHELL_ERR_NO_INPUTFILE,
+    SSHELL_ERR_NO_OUTPUTFILE,
+    SSHELL_ERR_INPUT_MISLOCATED,
+    SSHELL_ERR_OUTPUT_MISLOCATED,
+    SSHELL_ERR_BACKGROUND_MISLOCATED,
+    SSHELL_ERR_FORK,
+    SSHELL_NUM_ERRORS               /* the first code free for the caller */
+};
+
+/* in_caller hook code */
+enum {
+    SSHELL_SPAWN,                   /* fork and exec the command */
+    SSHELL_FORK,                    /* fork, run_in_child runs the command */
+    SSHELL_RAN,                     /* the caller ran the command, no process */
+    SSHELL_STOP                     /* the caller ran the command, do not start the rest */
+};
+
+/* allocator struct: every allocation of a job goes through it, NULL for malloc() and free() */
+struct sshell_allocator {
+    void *(*alloc)(void *data, size_t size);    /* returns NULL when out of memory */
+    void (*release)(void *data, void *ptr);
+    void *data;                     /* passed to alloc and release */
+};
+
+/* place code of the word of a process substitution */
+enum {
+    SSHELL_IN_ARGS,                 /* an argument */
+    SSHELL_IN_INPUT,                /* an input file */
+    SSHELL_IN_OUTPUT                /* an output file */
+};
+
+/* process substitution struct: <(pipeline) or >(pipeline) in place of a word of a command, the
+   first word of its place still starting with <( or >( when the command is spawned */
+struct sshell_substitution {
+    struct sshell_job *job;         /* the pipeline, NULL if its parenthesis is not closed */
+    int output;                     /* one for >(...): the pipeline reads what the command writes */
+    int place;                      /* place code of its word */
+};
+
+/* command struct */
+struct sshell_command {
+    pid_t pid;                      /* the process id, zero if the command has no process */
+    int status;                     /* exit status */
+    int error;                      /* error code of the child before exec */
+    char command[SSHELL_MAX_CMD];   /* the whole command */
+    char *args[SSHELL_MAX_ARGS];    /* arguments of the command */
+    int num_input;                  /* number of input redirection */
+    int num_output;                 /* number of output redirection */
+    char *input_file[SSHELL_MAX_ARGS];  /* the array of the input files */
+    char *output_file[SSHELL_MAX_ARGS]; /* the array of the output files */
+    int output_append[SSHELL_MAX_ARGS]; /* one for an output file opened by >> */
+    int num_args;                   /* number of arguments in the command line */
+    struct sshell_command *next_command;    /* the comamnd for pipeling */
+    int finish;                     /* finish flag */
+    int background;                 /* number of background signs */
+    int num_substitutions;          /* number of process substitutions */
+    struct sshell_substitution substitutions[SSHELL_MAX_SUBST];   /* replaced by /dev/fd/N when spawned */
+    int num_branches;               /* number of pipelines of |{ a ; b }, zero for a program */
+    struct sshell_job *branches[SSHELL_MAX_BRANCHES];   /* each reads a copy of the input, NULL if invalid */
+};
+
+/* job struct */
+struct sshell_job {
+    char commandline[SSHELL_MAX_CMD];       /* the total command line */
+    struct sshell_command *first_command;   /* the first command of a job */
+    int num_processes;              /* the number of commands/processes */
+    int finish;                     /* finish flag */
+    pid_t pgid;                     /* the process group of the job (the pid of its first process if not
+                                       grouped), zero before it is spawned */
+    int grouped;                    /* one to spawn the job in a process group of its own (the default),
+                                       zero to leave its processes in the group of the caller */
+    int stopped;                    /* stopped flag */
+    struct sshell_job *next_job;    /* free for the lists of the caller */
+    void *data;                     /* free for the caller */
+    struct sshell_allocator allocator;      /* the allocator of the job */
+};
+
+/* hooks struct: lets the caller take part in sshell_spawn(), every hook may be NULL. The commands
+   of a process substitution come with the job they belong to */
+struct sshell_hooks {
+    void *data;                     /* passed to every hook */
+    /* in the caller before the fork of each command: a hook code, the caller sets the status
+       and the finish flag of a command it ran */
+    int (*in_caller)(void *data, struct sshell_job *job, struct sshell_command *cmd);
+    /* first thing in each child, in the process group of the job */
+    void (*in_child)(void *data, struct sshell_job *job, struct sshell_command *cmd);
+    /* in the child of an SSHELL_FORK command after its redirections: returns its exit status */
+    int (*run_in_child)(void *data, struct sshell_job *job, struct sshell_command *cmd);
+    /* in the caller for the pipe after each command: returns the read end for the next command */
+    int (*on_pipe)(void *data, struct sshell_job *job, struct sshell_command *cmd, int read_fd);
+};
+
+/*************************************************************
+ *                    LIBRARY FUNCTIONS                      *
+ *************************************************************/
+
+/* parsing and checking, no output */
+struct sshell_job *sshell_parse(const char *line, const struct sshell_allocator *allocator);
+struct sshell_job *sshell_clone(const struct sshell_job *job);
+void sshell_free_job(struct sshell_job *job);
+int sshell_validate(struct sshell_job *job, int check_files);
+const char *sshell_strerror(int error_code);
+
+/* memory of the job */
+void *sshell_alloc(const struct sshell_job *job, size_t size);
+void sshell_release(const struct sshell_job *job, void *ptr);
+char *sshell_strdup(const struct sshell_job *job, const char *string);
+
+/* running */
+int sshell_spawn(struct sshell_job *job, const struct sshell_hooks *hooks);
+int sshell_record(struct sshell_job *job, pid_t pid, int status);
+int sshell_poll(struct sshell_job *job);
+int sshell_wait(struct sshell_job *job);
+pid_t sshell_waitpid(const struct sshell_job *job, int *status, int options);
+int sshell_signal(const struct sshell_job *job, int sig);
+int sshell_status(const struct sshell_job *job);
+int sshell_exit_status(int status);
+struct sshell_command *sshell_last_command(const struct sshell_job *job);
+int sshell_check_finish(const struct sshell_job *job);
+
+/* redirections of a command the caller runs itself */
+int sshell_redirect(const struct sshell_command *cmd);
+pid_t sshell_start_relay(const struct sshell_command *cmd, int *error_code);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,281 @@
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/*************************************************************
+ *                    MACRO DEFINITIONS                      *
+ *************************************************************/
+
+#define MAX_CMD 512
+#define MAX_CONNS 256
+#define BUFFER_SIZE 65536
+
+/*************************************************************
+ *                    STRUCT DEFINITIONS                     *
+ *************************************************************/
+
+/* connection struct */
+struct connection {
+    int fd;                         /* the socket */
+    int sent;                       /* requests sent */
+    int in_flight;                  /* requests sent and not answered */
+    char input[BUFFER_SIZE];        /* the replies not read yet */
+    size_t input_len;
+    size_t skip;                    /* bytes of output left to skip */
+    double *started;                /* when each request was sent, indexed by its tag */
+};
+
+/*************************************************************
+ *                    FUNCTION PROTOTYPES                    *
+ *************************************************************/
+
+double now();
+int connect_server(const char *path);
+int send_request(struct connection *conn, const char *line, int capture);
+int read_replies(struct connection *conn, double *latencies, int *num_latencies, int *errors);
+int compare_double(const void *a, const void *b);
+double percentile(const double *latencies, int n, double p);
+
+/*************************************************************
+ *                    FUNCTIONS                              *
+ *************************************************************/
+
+/*
+ * This function gives the monotonic time
+ * @param - none
+ * @return - {double} - the time in seconds
+ */
+double now() {
+    struct timespec time;
+
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+/*
+ * This function connects to the server
+ * @param - {const char *} - the path of the socket
+ * @return - {int} - the socket, -1 on error
+ */
+int connect_server(const char *path) {
+    struct sockaddr_un address;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+    if(fd < 0 || connect(fd, (struct sockaddr*) &address, sizeof(address)) < 0) {
+        perror(path);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * This function sends the next request of the connection, tagged with its number
+ * @param - {connection *} - the connection
+ *        - {const char *} - the command line
+ *        - {int} - one to ask for the output
+ * @return - {int} - zero on success, -1 on error
+ */
+int send_request(struct connection *conn, const char *line, int capture) {
+    char request[MAX_CMD + 32];
+    int length = snprintf(request, sizeof(request), "%d %s%s\n", conn->sent, capture ? "-o " : "", line);
+    int n, done = 0;
+
+    conn->started[conn->sent] = now();
+    while(done < length) {                                  /* the server may push back */
+        n = write(conn->fd, request + done, length - done);
+        if(n < 0 && errno == EINTR) {
+            continue;
+        }
+        if(n < 0) {
+            return -1;
+        }
+        done += n;
+    }
+    conn->sent++;
+    conn->in_flight++;
+    return 0;
+}
+
+/*
+ * This function reads the replies waiting on the connection and records the latency of
+ *  each request answered, skipping its output
+ * @param - {connection *} - the connection
+ *        - {double *} - the latencies
+ *        - {int *} - number of latencies
+ *        - {int *} - number of requests that failed or exited with non-zero status
+ * @return - {int} - zero on success, -1 once the server closed the connection
+ */
+int read_replies(struct connection *conn, double *latencies, int *num_latencies, int *errors) {
+    char *line, *end, *kind, *rest;
+    size_t skipped;
+    int n, tag;
+
+    n = read(conn->fd, conn->input + conn->input_len, sizeof(conn->input) - conn->input_len);
+    if(n < 0 && errno == EINTR) {
+        return 0;
+    }
+    if(n <= 0) {
+        return -1;
+    }
+    conn->input_len += n;
+
+    line = conn->input;
+    while(line < conn->input + conn->input_len) {
+        if(conn->skip > 0) {                                /* output of a request */
+            skipped = conn->input + conn->input_len - line;
+            skipped = skipped < conn->skip ? skipped : conn->skip;
+            conn->skip -= skipped;
+            line += skipped;
+            continue;
+        }
+        end = memchr(line, '\n', conn->input + conn->input_len - line);
+        if(end == NULL) {
+            break;
+        }
+        *end = 0;
+
+        /* TAG out LENGTH, TAG exit STATUS..., or TAG fail MESSAGE */
+        tag = strtol(line, &kind, 10);
+        kind++;
+        if(strncmp(kind, "out ", 4) == 0) {
+            conn->skip = strtoul(kind + 4, NULL, 10);
+        } else {
+            latencies[(*num_latencies)++] = now() - conn->started[tag];
+            conn->in_flight--;
+            if(strncmp(kind, "exit", 4) == 0) {
+                for(rest = kind + 4; *rest; rest++) {
+                    if(*rest != ' ' && *rest != '0') {
+                        (*errors)++;
+                        break;
+                    }
+                }
+            } else {
+                (*errors)++;
+            }
+        }
+        line = end + 1;
+    }
+    conn->input_len -= line - conn->input;
+    memmove(conn->input, line, conn->input_len);
+    return 0;
+}
+
+/*
+ * This function compares two latencies for qsort
+ */
+int compare_double(const void *a, const void *b) {
+    double x = *(const double*) a, y = *(const double*) b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * This function gives the percentile of the sorted latencies
+ * @param - {const double *} - the sorted latencies
+ *        - {int} - number of latencies
+ *        - {double} - the percentile, between 0 and 100
+ * @return - {double} - the latency
+ */
+double percentile(const double *latencies, int n, double p) {
+    int i = (int) (p / 100 * n);
+    return latencies[i < n ? i : n - 1];
+}
+
+/*
+ * main function of the load client: sends REQUESTS requests of COMMAND over CONNS connections,
+ *  DEPTH at a time on each, and reports the requests per second and the latencies
+ */
+int main(int argc, char *argv[]) {
+    struct connection *conns;
+    struct pollfd fds[MAX_CONNS];
+    char line[MAX_CMD] = "";
+    double *latencies, start, elapsed;
+    int num_conns = 1, num_requests = 1000, depth = 1, capture = 0;
+    int i, opt, per_conn, num_latencies = 0, errors = 0, done;
+
+    while((opt = getopt(argc, argv, "+c:n:d:o")) != -1) {
+        switch(opt) {
+            case 'c': num_conns = atoi(optarg); break;
+            case 'n': num_requests = atoi(optarg); break;
+            case 'd': depth = atoi(optarg); break;
+            case 'o': capture = 1; break;
+            default: optind = argc; break;
+        }
+    }
+    if(argc - optind < 2 || num_conns < 1 || num_conns > MAX_CONNS || num_requests < 1 || depth < 1) {
+        fprintf(stderr, "Usage: sshell_load [-c CONNS] [-n REQUESTS] [-d DEPTH] [-o] SOCKET COMMAND...\n");
+        return EXIT_FAILURE;
+    }
+    for(i = optind + 1; i < argc; i++) {                    /* the command line */
+        if(strlen(line) + strlen(argv[i]) + 2 > sizeof(line)) {
+            fprintf(stderr, "Error: command line too long\n");
+            return EXIT_FAILURE;
+        }
+        strcat(line, argv[i]);
+        strcat(line, i + 1 < argc ? " " : "");
+    }
+
+    per_conn = (num_requests + num_conns - 1) / num_conns;
+    conns = (struct connection*) calloc(num_conns, sizeof(struct connection));
+    latencies = (double*) malloc(num_conns * per_conn * sizeof(double));
+    for(i = 0; i < num_conns; i++) {
+        conns[i].fd = connect_server(argv[optind]);
+        conns[i].started = (double*) malloc(per_conn * sizeof(double));
+        if(conns[i].fd < 0) {
+            return EXIT_FAILURE;
+        }
+        fds[i].fd = conns[i].fd;
+        fds[i].events = POLLIN;
+    }
+
+    start = now();
+    do {
+        done = 1;
+        for(i = 0; i < num_conns; i++) {                    /* keep DEPTH requests in flight */
+            while(conns[i].fd >= 0 && conns[i].in_flight < depth && conns[i].sent < per_conn) {
+                if(send_request(&conns[i], line, capture) < 0) {
+                    perror("write");
+                    return EXIT_FAILURE;
+                }
+            }
+            if(conns[i].in_flight > 0 || conns[i].sent < per_conn) {
+                done = 0;
+            }
+        }
+        if(done) {
+            break;
+        }
+        poll(fds, num_conns, -1);
+        for(i = 0; i < num_conns; i++) {
+            if(fds[i].revents && read_replies(&conns[i], latencies, &num_latencies, &errors) < 0) {
+                fprintf(stderr, "Error: server closed the connection\n");
+                return EXIT_FAILURE;
+            }
+        }
+    } while(1);
+    elapsed = now() - start;
+
+    qsort(latencies, num_latencies, sizeof(double), compare_double);
+    printf("requests %d, errors %d, %.3f s, %.0f req/s\n", num_latencies, errors, elapsed,
+        num_latencies / elapsed);
+    printf("latency ms: p50 %.3f, p90 %.3f, p99 %.3f, p99.9 %.3f, max %.3f\n",
+        1000 * percentile(latencies, num_latencies, 50), 1000 * percentile(latencies, num_latencies, 90),
+        1000 * percentile(latencies, num_latencies, 99), 1000 * percentile(latencies, num_latencies, 99.9),
+        1000 * latencies[num_latencies - 1]);
+
+    for(i = 0; i < num_conns; i++) {
+        close(conns[i].fd);
+        free(conns[i].started);
+    }
+    free(conns);
+    free(latencies);
+    return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,30 @@
+#!/bin/sh
+# Checks that an output redirection after |{ ... } is the shared output of the branches, and
+# that a misplaced or doubled one is rejected.
+# Run from the top of the tree after make: sh tests/branches.sh
+
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+status=0
+
+fail() {
+    echo "FAIL: $1"
+    status=1
+}
+
+cat > "$dir/script" <<END
+echo a | { cat ; tr a b } > $dir/out1
+echo c |{ cat } >> $dir/out1
+echo d |{ cat } > $dir/out2 | cat
+echo e |{ cat } > $dir/out2 > $dir/out3
+END
+
+./sshell < "$dir/script" > "$dir/out" 2>&1
+[ "$(sort "$dir/out1" | tr -d '\n')" = "abc" ] || fail "the branches did not write to the file"
+grep -q "^Error: mislocated output redirection" "$dir/out" || fail "a group redirected before | ran"
+grep -q "^Error: invalid command line" "$dir/out" || fail "two output files on a group ran"
+[ -e "$dir/out2" ] || [ -e "$dir/out3" ] && fail "a rejected group opened its file"
+
+[ $status -ne 0 ] && cat "$dir/out"
+[ $status -eq 0 ] && echo "PASS: branches"
+exit $status
@@ -0,0 +1,48 @@
+#!/bin/sh
+# Checks that the daemon fails a request line too long for it once, with its tag, and
+# runs nothing of it, while the requests after it still run.
+# Run from the top of the tree after make: sh tests/daemon.sh
+
+dir=$(mktemp -d) || exit 1
+trap 'kill $server 2> /dev/null; rm -rf "$dir"' EXIT
+status=0
+
+fail() {
+    echo "FAIL: $1"
+    status=1
+}
+
+./sshell --serve "$dir/socket" -j 2 > "$dir/log" 2>&1 &
+server=$!
+for i in 1 2 3 4 5 6 7 8 9 10; do
+    [ -S "$dir/socket" ] && break
+    sleep 0.2
+done
+
+# a 10 KB line whose tail would be a command, then a request that must still run
+python3 - "$dir" > "$dir/replies" <<'END'
+import socket, sys
+dir = sys.argv[1]
+s = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+s.connect(dir + "/socket")
+s.sendall(b"long echo " + b"y" * 10000 + b" ; touch " + dir.encode() + b"/pwned\n")
+s.sendall(b"next touch " + dir.encode() + b"/next\n")
+s.shutdown(socket.SHUT_WR)
+data = b""
+while True:
+    chunk = s.recv(65536)
+    if not chunk:
+        break
+    data += chunk
+sys.stdout.write(data.decode())
+END
+
+[ "$(grep -c fail "$dir/replies")" -eq 1 ] || fail "the long line did not get exactly one fail reply"
+grep -q "^long fail " "$dir/replies" || fail "the fail reply does not carry the tag"
+grep -q "^next exit 0" "$dir/replies" || fail "the request after the long line did not run"
+[ -e "$dir/pwned" ] && fail "the tail of the long line ran"
+[ -e "$dir/next" ] || fail "the request after the long line did nothing"
+
+[ $status -ne 0 ] && cat "$dir/replies" "$dir/log"
+[ $status -eq 0 ] && echo "PASS: daemon"
+exit $status
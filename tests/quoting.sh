@@ -0,0 +1,49 @@
+#!/bin/sh
+# Checks that quoted text is one word without its quotes, and that neither the list
+# splitter nor the tokenizer splits it at ; && | > or &.
+# Run from the top of the tree after make: sh tests/quoting.sh
+
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+status=0
+
+fail() {
+    echo "FAIL: $1"
+    status=1
+}
+
+cat > "$dir/script" <<'END'
+sh -c "echo one ; echo two"
+echo 'x && y'
+echo "a && b" ; echo c
+echo "p|q" | cat
+echo 'l > r' x"y z"w '' end
+echo a | { cat > /dev/null ; echo ';' }
+for i in "a b" c
+do
+echo [$i]
+done
+END
+
+./sshell < "$dir/script" > "$dir/out" 2>&1
+grep -v "^sshell\$ \|^> \|^+ completed\|^Bye\|^exit" "$dir/out" > "$dir/lines"
+cat > "$dir/expected" <<'END'
+one
+two
+x && y
+a && b
+c
+p|q
+l > r xy zw  end
+;
+[a b]
+[c]
+END
+
+cmp -s "$dir/lines" "$dir/expected" || fail "quoted words were split or kept their quotes"
+grep -q "^Error" "$dir/out" && fail "a quoted line was rejected"
+[ -e "$dir/r" ] && fail "a quoted > redirected"
+
+[ $status -ne 0 ] && cat "$dir/out"
+[ $status -eq 0 ] && echo "PASS: quoting"
+exit $status
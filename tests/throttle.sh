@@ -0,0 +1,52 @@
+#!/bin/sh
+# Checks that the throttle defers background jobs while a pressure file is over
+# the limit, lists and cancels them by id, and launches them once it falls.
+# Run from the top of the tree after make: sh tests/throttle.sh
+
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+status=0
+
+fail() {
+    echo "FAIL: $1"
+    status=1
+}
+
+echo "some avg10=90.00 avg60=0.00 avg300=0.00 total=0" > "$dir/memory"
+cat > "$dir/script" <<END
+throttle -m 50 -M $dir/memory -C $dir/none -i 0.1s
+touch $dir/ran &
+touch $dir/cancelled &
+jobs
+kill %2
+jobs
+END
+
+./sshell < "$dir/script" > "$dir/out" 2>&1 &
+shell=$!
+sleep 1
+
+grep -q "^+ deferred 'touch $dir/ran &'" "$dir/out" || fail "the job was not deferred"
+grep -q "^\[1\] Deferred 'touch $dir/ran &'" "$dir/out" || fail "jobs does not list the deferred job"
+grep -q "^+ cancelled 'touch $dir/cancelled &'" "$dir/out" || fail "kill %2 did not cancel the job"
+[ -e "$dir/ran" ] && fail "the job ran over the limit"
+kill -0 $shell 2> /dev/null || fail "the shell exited with a deferred job"
+
+echo "some avg10=1.00 avg60=0.00 avg300=0.00 total=0" > "$dir/memory"
+for i in 1 2 3 4 5 6 7 8 9 10; do
+    kill -0 $shell 2> /dev/null || break
+    sleep 0.5
+done
+if kill -0 $shell 2> /dev/null; then
+    kill $shell
+    fail "the shell did not exit once the pressure fell"
+fi
+wait $shell
+
+[ -e "$dir/ran" ] || fail "the job did not run once the pressure fell"
+[ -e "$dir/cancelled" ] && fail "the cancelled job ran"
+grep -q "Error: active jobs" "$dir/out" && fail "exit was retried while the job waited"
+
+[ $status -ne 0 ] && cat "$dir/out"
+[ $status -eq 0 ] && echo "PASS: throttle"
+exit $status